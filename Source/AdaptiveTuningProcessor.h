@@ -0,0 +1,272 @@
+/*
+  ==============================================================================
+
+    AdaptiveTuningProcessor.h
+
+    The engine as an AudioProcessor, for the VST3, LV2 and standalone
+    builds of AdaptiveTuningPlugin.jucer. Each instance owns its own
+    SynthAudioSource, keyboard state and parameters, and processBlock()
+    renders straight into the host's buffer with the host's MIDI: there's
+    no device layer or MIDI collector in between, and nothing in it waits
+    for the message thread.
+
+    The parameters are read at the start of every block, on the audio
+    thread, so automation lands on the block it's meant for even when a
+    host bounces faster than real time. None of them needs any work off the
+    audio thread: the limits' tables are built at compile time.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "SynthAudioSource.h"
+
+//==============================================================================
+class AdaptiveTuningProcessor  : public juce::AudioProcessor
+{
+public:
+    AdaptiveTuningProcessor()
+        : juce::AudioProcessor (BusesProperties().withOutput ("Output", juce::AudioChannelSet::stereo(), true)),
+          parameters (*this, nullptr, "AdaptiveTuning", createParameterLayout())
+    {
+        limitParameter = parameters.getRawParameterValue ("limit");
+        soundParameter = parameters.getRawParameterValue ("sound");
+        referenceParameter = parameters.getRawParameterValue ("reference");
+    }
+
+    //==============================================================================
+    void prepareToPlay (double sampleRate, int samplesPerBlock) override
+    {
+        engine.prepareToPlay (samplesPerBlock, sampleRate);
+    }
+
+    void releaseResources() override
+    {
+        engine.releaseResources();
+    }
+
+    bool isBusesLayoutSupported (const BusesLayout& layouts) const override
+    {
+        auto output = layouts.getMainOutputChannelSet();
+        return output == juce::AudioChannelSet::mono() || output == juce::AudioChannelSet::stereo();
+    }
+
+    void processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midi) override
+    {
+        juce::ScopedNoDenormals noDenormals;
+        applyParameters();
+
+        // the voices add themselves in, so the host's buffer has to start out silent
+        buffer.clear();
+        engine.renderNextBlock (buffer, midi, 0, buffer.getNumSamples());
+    }
+
+    using juce::AudioProcessor::processBlock;
+
+    //==============================================================================
+    juce::AudioProcessorEditor* createEditor() override;
+    bool hasEditor() const override                         { return true; }
+
+    const juce::String getName() const override             { return "Adaptive Tuning"; }
+    bool acceptsMidi() const override                       { return true; }
+    bool producesMidi() const override                      { return false; }
+    bool isMidiEffect() const override                      { return false; }
+    double getTailLengthSeconds() const override            { return engine.getTailLengthSeconds(); }
+
+    int getNumPrograms() override                           { return 1; }
+    int getCurrentProgram() override                        { return 0; }
+    void setCurrentProgram (int) override                   {}
+    const juce::String getProgramName (int) override        { return {}; }
+    void changeProgramName (int, const juce::String&) override {}
+
+    //==============================================================================
+    void getStateInformation (juce::MemoryBlock& destData) override
+    {
+        if (auto xml = parameters.copyState().createXml())
+            copyXmlToBinary (*xml, destData);
+    }
+
+    void setStateInformation (const void* data, int sizeInBytes) override
+    {
+        auto xml = getXmlFromBinary (data, sizeInBytes);
+
+        if (xml == nullptr || ! xml->hasTagName (parameters.state.getType()))
+            return;
+
+        parameters.replaceState (juce::ValueTree::fromXml (*xml));
+
+        auto path = parameters.state[sampleFileProperty].toString();
+
+        if (juce::File::isAbsolutePath (path))
+            engine.loadSampledSoundAsync (juce::File (path));
+    }
+
+    //==============================================================================
+    /** Loads a sample or .sfz instrument in the background, and remembers it
+        in the saved state.
+    */
+    void loadSample (const juce::File& file)
+    {
+        parameters.state.setProperty (sampleFileProperty, file.getFullPathName(), nullptr);
+        engine.loadSampledSoundAsync (file);
+    }
+
+    juce::File getSampleFile() const
+    {
+        auto path = parameters.state[sampleFileProperty].toString();
+        return juce::File::isAbsolutePath (path) ? juce::File (path) : juce::File();
+    }
+
+    SynthAudioSource& getEngine() noexcept                  { return engine; }
+    juce::MidiKeyboardState& getKeyboardState() noexcept    { return keyboardState; }
+    juce::AudioProcessorValueTreeState& getValueTreeState() noexcept { return parameters; }
+
+    static juce::StringArray getLimitNames()                { return { "3-Limit (Pythagorean)", "5-Limit", "7-Limit" }; }
+    static juce::StringArray getSoundNames()                { return { "Sine wave", "Sampled sound", "Additive piano" }; }
+    static juce::StringArray getReferenceNames()            { return { "Lowest note", "Chord root", "Most consonant" }; }
+
+private:
+    static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout()
+    {
+        // the engine starts out on the 7-limit table
+        return { std::make_unique<juce::AudioParameterChoice> ("limit", "Limit", getLimitNames(), 2),
+                 std::make_unique<juce::AudioParameterChoice> ("sound", "Sound", getSoundNames(), 0),
+                 std::make_unique<juce::AudioParameterChoice> ("reference", "Tune To", getReferenceNames(), 0) };
+    }
+
+    /** Audio thread: hands any parameter changes to the engine before the block. */
+    void applyParameters() noexcept
+    {
+        auto limitId = 1 + (int) limitParameter->load();
+
+        if (limitId != appliedLimitId)
+        {
+            engine.setTuningLimit (limitId);
+            appliedLimitId = limitId;
+        }
+
+        auto sound = juce::roundToInt (soundParameter->load());
+
+        if (sound != appliedSound)
+        {
+            engine.selectSound (sound == 1 ? EngineSound::Engine::sampler
+                              : sound == 2 ? EngineSound::Engine::piano
+                                           : EngineSound::Engine::sine);
+            appliedSound = sound;
+        }
+
+        engine.setReferenceStrategy ((TuningReference::Strategy) (int) referenceParameter->load());
+    }
+
+    static constexpr const char* sampleFileProperty = "sampleFile";
+
+    juce::MidiKeyboardState keyboardState;
+    SynthAudioSource engine { keyboardState };
+    juce::AudioProcessorValueTreeState parameters;
+    std::atomic<float>* limitParameter = nullptr;
+    std::atomic<float>* soundParameter = nullptr;
+    std::atomic<float>* referenceParameter = nullptr;
+    int appliedLimitId = 0;         // audio thread only
+    int appliedSound = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AdaptiveTuningProcessor)
+};
+
+//==============================================================================
+class AdaptiveTuningEditor  : public juce::AudioProcessorEditor,
+                              private juce::Timer
+{
+public:
+    explicit AdaptiveTuningEditor (AdaptiveTuningProcessor& p)
+        : juce::AudioProcessorEditor (p),
+          tuningProcessor (p),
+          keyboardComponent (p.getKeyboardState(), juce::MidiKeyboardComponent::horizontalKeyboard)
+    {
+        limitBox.addItemList (AdaptiveTuningProcessor::getLimitNames(), 1);
+        soundBox.addItemList (AdaptiveTuningProcessor::getSoundNames(), 1);
+        referenceBox.addItemList (AdaptiveTuningProcessor::getReferenceNames(), 1);
+        limitAttachment = std::make_unique<ComboBoxAttachment> (p.getValueTreeState(), "limit", limitBox);
+        soundAttachment = std::make_unique<ComboBoxAttachment> (p.getValueTreeState(), "sound", soundBox);
+        referenceAttachment = std::make_unique<ComboBoxAttachment> (p.getValueTreeState(), "reference", referenceBox);
+
+        loadSampleButton.onClick = [this] { chooseSampleFile(); };
+        resetButton.onClick = [this] { tuningProcessor.getEngine().resetPitchDrift(); };
+
+        for (auto* c : std::initializer_list<juce::Component*> { &limitBox, &soundBox, &referenceBox, &loadSampleButton, &resetButton,
+                                                                 &keyboardComponent, &telemetryLabel, &driftLabel })
+            addAndMakeVisible (c);
+
+        telemetryLabel.setFont (juce::Font (12.0f));
+        driftLabel.setJustificationType (juce::Justification::centredRight);
+
+        setSize (600, 220);
+        startTimer (400);
+    }
+
+    void resized() override
+    {
+        auto area = getLocalBounds().reduced (10);
+
+        auto topRow = area.removeFromTop (24);
+        limitBox.setBounds (topRow.removeFromLeft (180));
+        topRow.removeFromLeft (10);
+        soundBox.setBounds (topRow.removeFromLeft (140));
+        topRow.removeFromLeft (10);
+        loadSampleButton.setBounds (topRow.removeFromLeft (110));
+        resetButton.setBounds (topRow.removeFromRight (120));
+
+        area.removeFromTop (6);
+        auto secondRow = area.removeFromTop (24);
+        referenceBox.setBounds (secondRow.removeFromLeft (180));
+        driftLabel.setBounds (secondRow.removeFromRight (160));
+
+        telemetryLabel.setBounds (area.removeFromBottom (20));
+        keyboardComponent.setBounds (area.withTrimmedTop (8).withTrimmedBottom (4));
+    }
+
+    void paint (juce::Graphics& g) override
+    {
+        g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
+    }
+
+private:
+    using ComboBoxAttachment = juce::AudioProcessorValueTreeState::ComboBoxAttachment;
+
+    void chooseSampleFile()
+    {
+        sampleChooser = std::make_unique<juce::FileChooser> ("Please select the wav or sfz you want to load...",
+                                                             tuningProcessor.getSampleFile().getParentDirectory(),
+                                                             "*.wav;*.sfz");
+
+        sampleChooser->launchAsync (juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles,
+                                    [this] (const juce::FileChooser& chooser)
+        {
+            auto file = chooser.getResult();
+
+            if (file.existsAsFile())
+                tuningProcessor.loadSample (file);
+        });
+    }
+
+    void timerCallback() override
+    {
+        telemetryLabel.setText (tuningProcessor.getEngine().getTelemetry().getSnapshot().getDescription(), juce::dontSendNotification);
+        driftLabel.setText (SynthAudioSource::describePitchDrift (tuningProcessor.getEngine().getPitchDriftCents()), juce::dontSendNotification);
+    }
+
+    AdaptiveTuningProcessor& tuningProcessor;
+    juce::ComboBox limitBox, soundBox, referenceBox;
+    juce::TextButton loadSampleButton { "Load sample..." }, resetButton { "Reset Pitch Drift" };
+    juce::MidiKeyboardComponent keyboardComponent;
+    juce::Label telemetryLabel, driftLabel;
+    std::unique_ptr<ComboBoxAttachment> limitAttachment, soundAttachment, referenceAttachment;
+    std::unique_ptr<juce::FileChooser> sampleChooser;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AdaptiveTuningEditor)
+};
+
+inline juce::AudioProcessorEditor* AdaptiveTuningProcessor::createEditor()
+{
+    return new AdaptiveTuningEditor (*this);
+}
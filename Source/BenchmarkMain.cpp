@@ -0,0 +1,608 @@
+/*
+  ==============================================================================
+
+    This file contains the startup code for the voice render benchmarks.
+
+    Each benchmark target renders blocks through one of the engine's render
+    paths while the polyphony, block size and sample rate are swept:
+
+        sine     SynthVoice::renderNextBlock called directly, playing the sine
+        sine-precise   the same, with the std::sin oscillator
+        piano    the same, playing the additive piano
+        sampler  SynthVoice inside a plain Synthesiser holding only the sampled sound
+                 (the voice needs the Synthesiser to hand it its sound)
+        sampler-linear  the same, with linear instead of windowed-sinc interpolation
+        synth    the full SynthAudioSource path, MIDI, keyboard state and voice
+                 allocation included, with its polyphony set to the voice count
+        synth-sampler  the same, with the sampled sound loaded
+
+    --storage picks the in-memory sample format for the sampler paths,
+    --threads the number of worker threads the synth paths share voices with,
+    and --floor the synth paths' audibility floor in dB below the mix, below
+    which releasing notes are ended early (-100 turns that off).
+
+    --budget and --baseline turn a run into a check: the exit code is
+    non-zero if any measurement's load goes over the budget, in percent of
+    the block's duration, or if its ns/sample is more than --max-regression
+    percent slower than the same measurement in a CSV saved by an earlier run.
+
+    Usage:
+        Benchmarks [--paths sine,sine-precise,piano,sampler,sampler-linear,synth,synth-sampler] [--voices 1,2,4,...,256]
+                   [--blocks 16,...,4096] [--rates 44100,48000,96000]
+                   [--deadline 0.7] [--min-time 50] [--sample piano.wav]
+                   [--storage float32|int16|half] [--threads 0] [--floor -80] [--csv results.csv]
+                   [--budget 70] [--baseline previous.csv] [--max-regression 10]
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "SynthAudioSource.h"
+
+//==============================================================================
+/** A render path under test. Starting and releasing notes happens outside the
+    timed region; only render() is timed.
+*/
+struct BenchmarkTarget
+{
+    virtual ~BenchmarkTarget() = default;
+
+    virtual juce::String getName() const = 0;
+    virtual void prepare (double sampleRate, int blockSize, int numVoices) = 0;
+    virtual void startVoices() = 0;
+    virtual void releaseVoices() = 0;
+    virtual void render (juce::AudioBuffer<float>& buffer, int numSamples) = 0;
+    virtual int getNumActiveVoices() const = 0;
+};
+
+/** Gives every voice its own channel/note pair so the Synthesiser never
+    retriggers a voice that's already playing.
+*/
+static int getBenchmarkChannel (int voiceIndex)    { return 1 + (voiceIndex / 64) % 16; }
+static int getBenchmarkNote (int voiceIndex)       { return 36 + voiceIndex % 64; }
+
+//==============================================================================
+struct SineVoiceTarget  : public BenchmarkTarget
+{
+    SineVoiceTarget (SineOscillator::Mode m) : mode (m) {}
+
+    juce::String getName() const override    { return mode == SineOscillator::Mode::fast ? "sine" : "sine-precise"; }
+
+    virtual EngineSound& getSound()          { return sound; }
+
+    void prepare (double sampleRate, int, int numVoices) override
+    {
+        voices.clear();
+
+        for (int i = 0; i < numVoices; ++i)
+        {
+            auto* voice = voices.add (new SynthVoice (state));
+            voice->setCurrentPlaybackSampleRate (sampleRate);
+            voice->setOscillatorMode (mode);
+        }
+    }
+
+    void startVoices() override
+    {
+        state.firstTime = true;
+
+        for (int i = 0; i < voices.size(); ++i)
+            voices.getUnchecked (i)->startNote (getBenchmarkNote (i), 0.8f, &getSound(), 8192);
+    }
+
+    void releaseVoices() override
+    {
+        for (auto* voice : voices)
+            voice->stopNote (0.0f, true);
+    }
+
+    void render (juce::AudioBuffer<float>& buffer, int numSamples) override
+    {
+        for (auto* voice : voices)
+            voice->renderNextBlock (buffer, 0, numSamples);
+    }
+
+    int getNumActiveVoices() const override    { return voices.size(); }
+
+    SineOscillator::Mode mode;
+    AdaptiveTuningState state;
+    SineWaveSound sound;
+    juce::OwnedArray<SynthVoice> voices;
+};
+
+//==============================================================================
+struct PianoVoiceTarget  : public SineVoiceTarget
+{
+    PianoVoiceTarget() : SineVoiceTarget (SineOscillator::Mode::fast) {}
+
+    juce::String getName() const override    { return "piano"; }
+    EngineSound& getSound() override         { return pianoSound; }
+
+    PianoSound pianoSound;
+};
+
+//==============================================================================
+struct SamplerVoiceTarget  : public BenchmarkTarget
+{
+    SamplerVoiceTarget (const juce::File& sample, SincInterpolator::Quality q, SampleStorage::Format f)
+        : sampleFile (sample), quality (q), format (f) {}
+
+    juce::String getName() const override
+    {
+        juce::String name (quality == SincInterpolator::Quality::sinc ? "sampler" : "sampler-linear");
+        return format == SampleStorage::Format::float32 ? name : name + "-" + SampleStorage::getName (format);
+    }
+
+    void prepare (double sampleRate, int, int numVoices) override
+    {
+        synth.clearVoices();
+        synth.clearSounds();
+
+        for (int i = 0; i < numVoices; ++i)
+        {
+            auto* voice = new SynthVoice (state);
+            voice->setInterpolation (quality);
+            synth.addVoice (voice);
+        }
+
+        juce::AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+        std::unique_ptr<juce::AudioFormatReader> reader (formatManager.createReaderFor (sampleFile));
+        jassert (reader != nullptr);
+
+        instrument = new SamplerInstrument();
+        instrument->addZone ({ SampleData::createFromReader (*reader, 1000.0, format) });
+
+        auto* sound = new SampledSound();
+        sound->instrument = instrument.get();
+        sound->enabled = true;
+        synth.addSound (sound);
+        synth.setCurrentPlaybackSampleRate (sampleRate);
+    }
+
+    void startVoices() override
+    {
+        synth.allNotesOff (0, false);
+        state.firstTime = true;
+
+        for (int i = 0; i < synth.getNumVoices(); ++i)
+            synth.noteOn (getBenchmarkChannel (i), getBenchmarkNote (i), 0.8f);
+    }
+
+    void releaseVoices() override
+    {
+        for (int i = 0; i < synth.getNumVoices(); ++i)
+            synth.noteOff (getBenchmarkChannel (i), getBenchmarkNote (i), 0.0f, true);
+    }
+
+    void render (juce::AudioBuffer<float>& buffer, int numSamples) override
+    {
+        synth.renderNextBlock (buffer, emptyMidi, 0, numSamples);
+    }
+
+    int getNumActiveVoices() const override
+    {
+        int numActive = 0;
+
+        for (int i = 0; i < synth.getNumVoices(); ++i)
+            if (synth.getVoice (i)->isVoiceActive())
+                ++numActive;
+
+        return numActive;
+    }
+
+    juce::File sampleFile;
+    SincInterpolator::Quality quality;
+    SampleStorage::Format format;
+    AdaptiveTuningState state;
+    SamplerInstrument::Ptr instrument;
+    juce::Synthesiser synth;
+    juce::MidiBuffer emptyMidi;
+};
+
+//==============================================================================
+/** The whole engine. Note-ons are rendered in an untimed block, but note-offs
+    are delivered inside the first timed block, as they would be live.
+*/
+struct FullSynthTarget  : public BenchmarkTarget
+{
+    FullSynthTarget (const juce::File& sample, SampleStorage::Format f = SampleStorage::Format::float32, int threads = 0,
+                     float floorDecibels = -80.0f)
+        : sampleFile (sample), format (f), numRenderThreads (threads), audibilityFloor (floorDecibels) {}
+
+    juce::String getName() const override
+    {
+        juce::String name ("synth");
+
+        if (sampleFile != juce::File())
+            name << (format == SampleStorage::Format::float32 ? "-sampler" : "-sampler-" + SampleStorage::getName (format));
+
+        return numRenderThreads > 0 ? name + "-" + juce::String (numRenderThreads) + "t" : name;
+    }
+
+    void prepare (double sampleRate, int blockSize, int numVoices) override
+    {
+        source.reset();
+        source = std::make_unique<SynthAudioSource> (keyboardState);
+
+        if (sampleFile != juce::File())
+        {
+            source->getSampleLoader().setStorageFormat (format);
+            source->loadSampledSound (sampleFile);
+        }
+
+        source->setPolyphony (numVoices);
+        source->setNumRenderThreads (numRenderThreads);
+        source->setAudibilityFloor (audibilityFloor);
+        source->prepareToPlay (blockSize, sampleRate);
+        scratch.setSize (2, blockSize);
+        voicesRequested = numVoices;
+    }
+
+    void startVoices() override
+    {
+        // let anything left over from the previous trial die away first
+        releaseVoices();
+
+        for (int i = 0; i < 10000 && (i == 0 || source->getNumActiveVoices() > 0); ++i)
+        {
+            scratch.clear();
+            render (scratch, scratch.getNumSamples());
+        }
+
+        source->resetPitchDrift();
+
+        for (int i = 0; i < voicesRequested; ++i)
+            pendingMidi.addEvent (juce::MidiMessage::noteOn (getBenchmarkChannel (i), getBenchmarkNote (i), 0.8f), 0);
+
+        scratch.clear();
+        render (scratch, scratch.getNumSamples());
+    }
+
+    void releaseVoices() override
+    {
+        for (int i = 0; i < voicesRequested; ++i)
+            pendingMidi.addEvent (juce::MidiMessage::noteOff (getBenchmarkChannel (i), getBenchmarkNote (i)), 0);
+    }
+
+    void render (juce::AudioBuffer<float>& buffer, int numSamples) override
+    {
+        source->renderNextBlock (buffer, pendingMidi, 0, numSamples);
+        pendingMidi.clear();
+    }
+
+    int getNumActiveVoices() const override    { return source->getNumActiveVoices(); }
+
+    juce::File sampleFile;
+    SampleStorage::Format format;
+    int numRenderThreads;
+    float audibilityFloor;
+    juce::MidiKeyboardState keyboardState;
+    std::unique_ptr<SynthAudioSource> source;
+    juce::AudioBuffer<float> scratch;
+    juce::MidiBuffer pendingMidi;
+    int voicesRequested = 0;
+};
+
+//==============================================================================
+struct BenchmarkResult
+{
+    juce::String path, mode;
+    double sampleRate = 0.0;
+    int blockSize = 0, voicesRequested = 0, voicesActive = 0;
+    double nsPerSample = 0.0, nsPerVoiceSample = 0.0, loadPercent = 0.0, voicesPerCore = 0.0;
+};
+
+class BenchmarkRunner
+{
+public:
+    BenchmarkRunner (double deadlineFraction, double minTimeMs)
+        : deadline (deadlineFraction), minTimeSeconds (minTimeMs * 0.001) {}
+
+    /** Times sustained voices over consecutive blocks, then voices that were
+        just released, so tail-off and sustain cost can be compared.
+    */
+    void run (BenchmarkTarget& target, double sampleRate, int blockSize, int numVoices,
+              juce::Array<BenchmarkResult>& results)
+    {
+        target.prepare (sampleRate, blockSize, numVoices);
+        buffer.setSize (2, blockSize);
+
+        auto blocksPerTrial = juce::jmax (1, (int) (sampleRate * 0.25) / blockSize);
+
+        results.add (measure (target, "sustain", sampleRate, blockSize, numVoices, blocksPerTrial, false));
+        results.add (measure (target, "tailoff", sampleRate, blockSize, numVoices, 1, true));
+    }
+
+private:
+    BenchmarkResult measure (BenchmarkTarget& target, const juce::String& mode, double sampleRate,
+                             int blockSize, int numVoices, int blocksPerTrial, bool release)
+    {
+        juce::int64 elapsedTicks = 0, numBlocks = 0, activeVoiceBlocks = 0;
+
+        // one untimed trial to warm caches and fault in the sample data
+        for (int trial = 0; trial < 2 || juce::Time::highResolutionTicksToSeconds (elapsedTicks) < minTimeSeconds; ++trial)
+        {
+            target.startVoices();
+            auto activeVoices = target.getNumActiveVoices();
+
+            if (release)
+                target.releaseVoices();
+
+            auto start = juce::Time::getHighResolutionTicks();
+
+            for (int block = 0; block < blocksPerTrial; ++block)
+            {
+                buffer.clear();
+                target.render (buffer, blockSize);
+            }
+
+            auto ticks = juce::Time::getHighResolutionTicks() - start;
+
+            if (trial > 0)
+            {
+                elapsedTicks += ticks;
+                numBlocks += blocksPerTrial;
+                activeVoiceBlocks += (juce::int64) activeVoices * blocksPerTrial;
+            }
+        }
+
+        BenchmarkResult r;
+        r.path = target.getName();
+        r.mode = mode;
+        r.sampleRate = sampleRate;
+        r.blockSize = blockSize;
+        r.voicesRequested = numVoices;
+        r.voicesActive = (int) (activeVoiceBlocks / juce::jmax ((juce::int64) 1, numBlocks));
+
+        auto elapsedNs = juce::Time::highResolutionTicksToSeconds (elapsedTicks) * 1.0e9;
+        auto numSamples = (double) numBlocks * blockSize;
+        auto nsPerBlock = elapsedNs / (double) numBlocks;
+        auto blockPeriodNs = blockSize / sampleRate * 1.0e9;
+
+        r.nsPerSample = elapsedNs / numSamples;
+        r.nsPerVoiceSample = r.voicesActive > 0 ? r.nsPerSample / r.voicesActive : 0.0;
+        r.loadPercent = 100.0 * nsPerBlock / blockPeriodNs;
+        r.voicesPerCore = r.voicesActive > 0 ? deadline * blockPeriodNs / (nsPerBlock / r.voicesActive) : 0.0;
+        return r;
+    }
+
+    double deadline, minTimeSeconds;
+    juce::AudioBuffer<float> buffer;
+};
+
+//==============================================================================
+static juce::Array<int> parseIntList (const juce::String& text)
+{
+    juce::Array<int> values;
+
+    for (auto& token : juce::StringArray::fromTokens (text, ",", {}))
+        values.add (token.getIntValue());
+
+    return values;
+}
+
+/** The key a measurement is matched on between runs. */
+static juce::String getResultKey (const BenchmarkResult& r)
+{
+    return r.path + "," + r.mode + "," + juce::String ((int) r.sampleRate) + ","
+             + juce::String (r.blockSize) + "," + juce::String (r.voicesRequested);
+}
+
+/** Reads the ns/sample of each measurement in a CSV written with --csv. */
+static juce::StringPairArray readBaseline (const juce::File& csvFile)
+{
+    juce::StringPairArray nsPerSample;
+    juce::StringArray lines;
+    csvFile.readLines (lines);
+
+    for (int i = 1; i < lines.size(); ++i)
+    {
+        auto fields = juce::StringArray::fromTokens (lines[i], ",", {});
+
+        if (fields.size() >= 7)
+            nsPerSample.set (fields[0] + "," + fields[1] + "," + juce::String ((int) fields[2].getDoubleValue()) + ","
+                               + fields[3] + "," + fields[4], fields[6]);
+    }
+
+    return nsPerSample;
+}
+
+/** Prints every measurement over the load budget or slower than its
+    baseline by more than maxRegressionPercent, and returns how many there were.
+*/
+static int checkResults (const juce::Array<BenchmarkResult>& results, double budgetPercent,
+                         const juce::StringPairArray& baseline, double maxRegressionPercent)
+{
+    int numFailed = 0;
+
+    for (auto& r : results)
+    {
+        if (budgetPercent > 0.0 && r.loadPercent > budgetPercent)
+        {
+            std::cout << "Over budget: " << getResultKey (r) << " took " << r.loadPercent
+                      << "% of the block, budget " << budgetPercent << "%" << std::endl;
+            ++numFailed;
+        }
+
+        auto previous = baseline.getValue (getResultKey (r), {}).getDoubleValue();
+
+        if (previous > 0.0 && r.nsPerSample > previous * (1.0 + maxRegressionPercent * 0.01))
+        {
+            std::cout << "Regressed: " << getResultKey (r) << " took " << r.nsPerSample
+                      << " ns/sample, was " << previous << std::endl;
+            ++numFailed;
+        }
+    }
+
+    return numFailed;
+}
+
+static juce::String formatResult (const BenchmarkResult& r)
+{
+    return r.path.paddedRight (' ', 9)
+         + r.mode.paddedRight (' ', 9)
+         + juce::String ((int) r.sampleRate).paddedLeft (' ', 7)
+         + juce::String (r.blockSize).paddedLeft (' ', 7)
+         + juce::String (r.voicesRequested).paddedLeft (' ', 7)
+         + juce::String (r.voicesActive).paddedLeft (' ', 7)
+         + juce::String (r.nsPerSample, 2).paddedLeft (' ', 12)
+         + juce::String (r.nsPerVoiceSample, 2).paddedLeft (' ', 12)
+         + juce::String (r.loadPercent, 2).paddedLeft (' ', 9)
+         + juce::String ((int) r.voicesPerCore).paddedLeft (' ', 10);
+}
+
+/** Writes a 10 second sine sweep so the sampler paths have something to
+    play when no sample is given.
+*/
+static bool writeDefaultSample (const juce::File& file)
+{
+    const double sampleRate = 44100.0;
+    juce::AudioBuffer<float> sample (1, (int) sampleRate * 10);
+    double angle = 0.0;
+
+    for (int i = 0; i < sample.getNumSamples(); ++i)
+    {
+        sample.setSample (0, i, (float) (0.5 * std::sin (angle)));
+        angle += juce::MathConstants<double>::twoPi * (261.63 + i * 0.001) / sampleRate;
+    }
+
+    file.deleteFile();
+    std::unique_ptr<juce::FileOutputStream> stream (file.createOutputStream());
+    juce::WavAudioFormat wavFormat;
+    std::unique_ptr<juce::AudioFormatWriter> writer (wavFormat.createWriterFor (stream.get(), sampleRate, 1, 24, {}, 0));
+
+    if (writer == nullptr)
+        return false;
+
+    stream.release();
+    return writer->writeFromAudioSampleBuffer (sample, 0, sample.getNumSamples());
+}
+
+int main (int argc, char* argv[])
+{
+    juce::StringArray args;
+
+    for (int i = 1; i < argc; ++i)
+        args.add (juce::CharPointer_UTF8 (argv[i]));
+
+    juce::StringArray paths { "sine", "sine-precise", "sampler", "synth" };
+    juce::Array<int> voiceCounts { 1, 2, 4, 8, 16, 32, 64, 128, 256 };
+    juce::Array<int> blockSizes { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+    juce::Array<int> sampleRates { 44100, 48000, 96000 };
+    double deadline = 0.7, minTimeMs = 50.0;
+    juce::File sampleFile, csvFile;
+    auto storageFormat = SampleStorage::Format::float32;
+    int renderThreads = 0;
+    float audibilityFloor = -80.0f;
+    double budgetPercent = 0.0, maxRegressionPercent = 10.0;
+    juce::File baselineFile;
+
+    for (int i = 0; i < args.size(); ++i)
+    {
+        auto arg = args[i];
+        auto hasValue = i + 1 < args.size();
+
+        if      (arg == "--paths"    && hasValue)  paths = juce::StringArray::fromTokens (args[++i], ",", {});
+        else if (arg == "--voices"   && hasValue)  voiceCounts = parseIntList (args[++i]);
+        else if (arg == "--blocks"   && hasValue)  blockSizes = parseIntList (args[++i]);
+        else if (arg == "--rates"    && hasValue)  sampleRates = parseIntList (args[++i]);
+        else if (arg == "--deadline" && hasValue)  deadline = args[++i].getDoubleValue();
+        else if (arg == "--min-time" && hasValue)  minTimeMs = args[++i].getDoubleValue();
+        else if (arg == "--sample"   && hasValue)  sampleFile = juce::File::getCurrentWorkingDirectory().getChildFile (args[++i]);
+        else if (arg == "--threads"  && hasValue)  renderThreads = args[++i].getIntValue();
+        else if (arg == "--floor"    && hasValue)  audibilityFloor = args[++i].getFloatValue();
+        else if (arg == "--csv"      && hasValue)  csvFile = juce::File::getCurrentWorkingDirectory().getChildFile (args[++i]);
+        else if (arg == "--budget"   && hasValue)  budgetPercent = args[++i].getDoubleValue();
+        else if (arg == "--baseline" && hasValue)  baselineFile = juce::File::getCurrentWorkingDirectory().getChildFile (args[++i]);
+        else if (arg == "--max-regression" && hasValue)  maxRegressionPercent = args[++i].getDoubleValue();
+        else if (arg == "--storage"  && hasValue && SampleStorage::parseName (args[i + 1], storageFormat))  ++i;
+        else
+        {
+            std::cout << "Usage: Benchmarks [--paths sine,sine-precise,piano,sampler,sampler-linear,synth,synth-sampler]" << std::endl
+                      << "                  [--voices 1,2,...,256] [--blocks 16,...,4096] [--rates 44100,48000,96000]" << std::endl
+                      << "                  [--deadline 0.7] [--min-time 50] [--sample piano.wav]" << std::endl
+                      << "                  [--storage float32|int16|half] [--threads 0] [--floor -80]" << std::endl
+                      << "                  [--csv results.csv] [--budget 70] [--baseline previous.csv] [--max-regression 10]" << std::endl;
+            return 1;
+        }
+    }
+
+    // read before anything runs, as --csv may be about to overwrite it
+    juce::StringPairArray baseline;
+
+    if (baselineFile != juce::File())
+    {
+        if (! baselineFile.existsAsFile())
+        {
+            std::cout << "No baseline at " << baselineFile.getFullPathName() << std::endl;
+            return 1;
+        }
+
+        baseline = readBaseline (baselineFile);
+    }
+
+    juce::TemporaryFile defaultSample (".wav");
+
+    if (sampleFile == juce::File())
+    {
+        if (! writeDefaultSample (defaultSample.getFile()))
+            return 1;
+
+        sampleFile = defaultSample.getFile();
+    }
+
+    juce::OwnedArray<BenchmarkTarget> targets;
+
+    for (auto& path : paths)
+    {
+        if      (path == "sine")     targets.add (new SineVoiceTarget (SineOscillator::Mode::fast));
+        else if (path == "sine-precise")  targets.add (new SineVoiceTarget (SineOscillator::Mode::precise));
+        else if (path == "piano")    targets.add (new PianoVoiceTarget());
+        else if (path == "sampler")  targets.add (new SamplerVoiceTarget (sampleFile, SincInterpolator::Quality::sinc, storageFormat));
+        else if (path == "sampler-linear")  targets.add (new SamplerVoiceTarget (sampleFile, SincInterpolator::Quality::linear, storageFormat));
+        else if (path == "synth")    targets.add (new FullSynthTarget ({}, SampleStorage::Format::float32, renderThreads, audibilityFloor));
+        else if (path == "synth-sampler")  targets.add (new FullSynthTarget (sampleFile, storageFormat, renderThreads, audibilityFloor));
+    }
+
+    // the audio device callback runs with denormals flushed, so do the same here
+    juce::ScopedNoDenormals noDenormals;
+    BenchmarkRunner runner (deadline, minTimeMs);
+    juce::Array<BenchmarkResult> results;
+
+    std::cout << "path     mode        rate  block voices active   ns/sample  ns/voice-s    load%  voices/core"
+              << " (deadline " << deadline * 100.0 << "% of block)" << std::endl;
+
+    for (auto* target : targets)
+    {
+        for (auto rate : sampleRates)
+        {
+            for (auto blockSize : blockSizes)
+            {
+                for (auto numVoices : voiceCounts)
+                {
+                    auto numBefore = results.size();
+                    runner.run (*target, (double) rate, blockSize, numVoices, results);
+
+                    for (int i = numBefore; i < results.size(); ++i)
+                        std::cout << formatResult (results.getReference (i)) << std::endl;
+                }
+            }
+        }
+    }
+
+    if (csvFile != juce::File())
+    {
+        juce::String csv ("path,mode,sample_rate,block_size,voices_requested,voices_active,ns_per_sample,ns_per_voice_sample,load_percent,voices_per_core\n");
+
+        for (auto& r : results)
+            csv << r.path << ',' << r.mode << ',' << r.sampleRate << ',' << r.blockSize << ','
+                << r.voicesRequested << ',' << r.voicesActive << ',' << r.nsPerSample << ','
+                << r.nsPerVoiceSample << ',' << r.loadPercent << ',' << r.voicesPerCore << '\n';
+
+        if (! csvFile.replaceWithText (csv))
+            return 1;
+    }
+
+    return checkResults (results, budgetPercent, baseline, maxRegressionPercent) == 0 ? 0 : 1;
+}
@@ -0,0 +1,501 @@
+/*
+  ==============================================================================
+
+    BlockTelemetry.h
+
+    Times each audio block, and the stages inside it, against the block's
+    own duration, so buffer sizes and polyphony can be chosen per machine
+    from measurements. The audio thread only stores into fixed histograms
+    and counters; summaries, percentiles and exports are worked out from
+    them on whichever thread asks.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+class BlockTelemetry
+{
+public:
+    enum class Stage
+    {
+        midiCollection,     // taking the block's MIDI from the collector
+        keyboardState,      // the tuning and instrument snapshot, keyboard state and held notes
+        synthRender,        // voice allocation and rendering
+        block               // the whole block, start to finish
+    };
+
+    static constexpr int numStages = 4;
+
+    static const char* getName (Stage stage) noexcept
+    {
+        switch (stage)
+        {
+            case Stage::midiCollection:  return "midi_collection";
+            case Stage::keyboardState:   return "keyboard_state";
+            case Stage::synthRender:     return "synth_render";
+            case Stage::block:           return "block";
+        }
+
+        return "";
+    }
+
+    /** Audio thread: the time stamps of one block on its way through the stages. */
+    class BlockTimer
+    {
+    public:
+        /** Ends the current stage, which began where the last one ended. */
+        void endStage (Stage stage) noexcept
+        {
+            auto now = juce::Time::getHighResolutionTicks();
+            durations[(size_t) stage] = now - lastTicks;
+            lastTicks = now;
+        }
+
+    private:
+        friend class BlockTelemetry;
+
+        juce::int64 startTicks = 0, lastTicks = 0;
+        std::array<juce::int64, numStages> durations { -1, -1, -1, -1 };    // -1 for a stage the block skipped
+    };
+
+    //==============================================================================
+    BlockTelemetry()
+        : ticksPerMicrosecond ((double) juce::Time::getHighResolutionTicksPerSecond() * 1.0e-6)
+    {
+    }
+
+    /** Forgets everything measured so far. Call this whenever the sample rate
+        or block size changes, since loads measured before no longer apply.
+    */
+    void reset() noexcept                                    { resetPending = true; }
+
+    void prepare (double newSampleRate) noexcept
+    {
+        sampleRate = newSampleRate;
+        reset();
+    }
+
+    /** A block taking at least this fraction of its duration, but not all of
+        it, counts as a near miss. 0.8 by default.
+    */
+    void setNearMissThreshold (float fraction) noexcept      { nearMissThreshold = fraction; }
+
+    //==============================================================================
+    /** Audio thread: starts timing a block. */
+    BlockTimer startBlock() const noexcept
+    {
+        BlockTimer timer;
+        timer.startTicks = timer.lastTicks = juce::Time::getHighResolutionTicks();
+        return timer;
+    }
+
+    /** Audio thread: records a block once it's been rendered. */
+    void finishBlock (BlockTimer& timer, int numSamples, int numActiveVoices) noexcept
+    {
+        timer.durations[(size_t) Stage::block] = juce::Time::getHighResolutionTicks() - timer.startTicks;
+
+        if (resetPending.exchange (false))
+            clear();
+
+        for (size_t i = 0; i < numStages; ++i)
+        {
+            if (timer.durations[i] < 0)
+                continue;
+
+            auto micros = (double) timer.durations[i] / ticksPerMicrosecond;
+            auto& stage = stages[i];
+            stage.histogram.add (getDurationBin (micros));
+            increase (stage.sumOfNanos, (juce::int64) (micros * 1000.0));
+            raise (stage.maxNanos, (juce::int64) (micros * 1000.0));
+        }
+
+        auto rate = sampleRate.load (std::memory_order_relaxed);
+
+        if (rate <= 0.0 || numSamples <= 0)
+            return;
+
+        auto periodMicros = numSamples * 1.0e6 / rate;
+        auto load = (double) timer.durations[(size_t) Stage::block] / ticksPerMicrosecond / periodMicros;
+        auto loadPpm = (juce::int64) (load * 1.0e6);
+
+        loadHistogram.add (juce::jmin (numLoadBins - 1, (int) (load * 100.0)));
+        increase (sumOfLoadPpm, loadPpm);
+        raise (maxLoadPpm, loadPpm);
+
+        if (load >= 1.0)
+            increase (numOverruns, 1);
+        else if (load >= nearMissThreshold.load (std::memory_order_relaxed))
+            increase (numNearMisses, 1);
+
+        auto& voices = voiceLoads[(size_t) juce::jlimit (0, maxTrackedVoices, numActiveVoices)];
+        increase (voices.numBlocks, 1);
+        increase (voices.sumOfLoadPpm, loadPpm);
+        raise (voices.maxLoadPpm, loadPpm);
+
+        lastNumVoices.store (numActiveVoices, std::memory_order_relaxed);
+    }
+
+    //==============================================================================
+    /** Some statistics of a distribution. Percentiles are the upper edge of
+        the histogram bin they fall in, so they're rounded up slightly.
+    */
+    struct Summary
+    {
+        juce::int64 count = 0;
+        double mean = 0, p50 = 0, p90 = 0, p99 = 0, p999 = 0, max = 0;
+    };
+
+    struct VoiceLoad
+    {
+        int numVoices;              // maxTrackedVoices stands for that many or more
+        juce::int64 numBlocks;
+        double meanLoad, maxLoad;
+    };
+
+    /** Everything measured since the last reset, in microseconds, or for
+        loads, fractions of the block duration.
+    */
+    struct Snapshot
+    {
+        double sampleRate = 0;
+        float nearMissThreshold = 0;
+        juce::int64 numNearMisses = 0, numOverruns = 0;
+        int lastNumVoices = 0;
+        std::array<Summary, numStages> stageMicroseconds;
+        Summary load;
+        std::vector<VoiceLoad> voiceLoads;      // only the voice counts that came up
+
+        /** One line for a status display. */
+        juce::String getDescription() const
+        {
+            if (load.count == 0)
+                return "No audio blocks measured yet";
+
+            return "Load " + percent (load.p50) + " median, " + percent (load.p99) + " p99, "
+                     + percent (load.max) + " max | " + juce::String (numNearMisses) + " near misses, "
+                     + juce::String (numOverruns) + " overruns | " + juce::String (lastNumVoices) + " voices";
+        }
+
+        juce::String toCsv() const
+        {
+            juce::String csv ("kind,name,count,mean,p50,p90,p99,p99_9,max\n");
+
+            auto addRow = [&csv] (const char* kind, const juce::String& name, const Summary& s, double scale)
+            {
+                csv << kind << ',' << name << ',' << s.count << ',' << s.mean * scale << ',' << s.p50 * scale << ','
+                    << s.p90 * scale << ',' << s.p99 * scale << ',' << s.p999 * scale << ',' << s.max * scale << '\n';
+            };
+
+            for (int i = 0; i < numStages; ++i)
+                addRow ("stage_us", getName ((Stage) i), stageMicroseconds[(size_t) i], 1.0);
+
+            addRow ("load_percent", "all", load, 100.0);
+
+            for (auto& v : voiceLoads)
+                csv << "voices_load_percent," << v.numVoices << ',' << v.numBlocks << ',' << v.meanLoad * 100.0
+                    << ",,,,," << v.maxLoad * 100.0 << '\n';
+
+            csv << "deadline,near_misses," << numNearMisses << ",,,,,,\n"
+                << "deadline,overruns," << numOverruns << ",,,,,,\n";
+
+            return csv;
+        }
+
+        juce::String toJson() const
+        {
+            auto toVar = [] (const Summary& s, double scale)
+            {
+                auto* object = new juce::DynamicObject();
+                object->setProperty ("count", s.count);
+                object->setProperty ("mean", s.mean * scale);
+                object->setProperty ("p50", s.p50 * scale);
+                object->setProperty ("p90", s.p90 * scale);
+                object->setProperty ("p99", s.p99 * scale);
+                object->setProperty ("p99_9", s.p999 * scale);
+                object->setProperty ("max", s.max * scale);
+                return juce::var (object);
+            };
+
+            auto* stagesObject = new juce::DynamicObject();
+
+            for (int i = 0; i < numStages; ++i)
+                stagesObject->setProperty (getName ((Stage) i), toVar (stageMicroseconds[(size_t) i], 1.0));
+
+            juce::Array<juce::var> voices;
+
+            for (auto& v : voiceLoads)
+            {
+                auto* object = new juce::DynamicObject();
+                object->setProperty ("voices", v.numVoices);
+                object->setProperty ("blocks", v.numBlocks);
+                object->setProperty ("mean_load_percent", v.meanLoad * 100.0);
+                object->setProperty ("max_load_percent", v.maxLoad * 100.0);
+                voices.add (juce::var (object));
+            }
+
+            auto* root = new juce::DynamicObject();
+            root->setProperty ("sample_rate", sampleRate);
+            root->setProperty ("near_miss_threshold_percent", nearMissThreshold * 100.0);
+            root->setProperty ("near_misses", numNearMisses);
+            root->setProperty ("overruns", numOverruns);
+            root->setProperty ("stages_us", juce::var (stagesObject));
+            root->setProperty ("load_percent", toVar (load, 100.0));
+            root->setProperty ("voices", voices);
+
+            return juce::JSON::toString (juce::var (root));
+        }
+
+    private:
+        static juce::String percent (double fraction)      { return juce::String (juce::roundToInt (fraction * 100.0)) + "%"; }
+    };
+
+    /** Summarises what's been measured. Safe to call on any thread, though a
+        block finishing meanwhile may be only partly included.
+    */
+    Snapshot getSnapshot() const
+    {
+        Snapshot s;
+        s.sampleRate = sampleRate.load();
+        s.nearMissThreshold = nearMissThreshold.load();
+        s.numNearMisses = numNearMisses.load();
+        s.numOverruns = numOverruns.load();
+        s.lastNumVoices = lastNumVoices.load();
+
+        for (size_t i = 0; i < numStages; ++i)
+        {
+            auto& stage = stages[i];
+            s.stageMicroseconds[i] = stage.histogram.summarise (getDurationBinLimit,
+                                                                (double) stage.sumOfNanos.load() * 1.0e-3,
+                                                                (double) stage.maxNanos.load() * 1.0e-3);
+        }
+
+        s.load = loadHistogram.summarise ([] (int bin) { return (bin + 1) * 0.01; },
+                                          (double) sumOfLoadPpm.load() * 1.0e-6,
+                                          (double) maxLoadPpm.load() * 1.0e-6);
+
+        for (int i = 0; i <= maxTrackedVoices; ++i)
+        {
+            auto& voices = voiceLoads[(size_t) i];
+            auto numBlocks = voices.numBlocks.load();
+
+            if (numBlocks > 0)
+                s.voiceLoads.push_back ({ i, numBlocks, (double) voices.sumOfLoadPpm.load() * 1.0e-6 / (double) numBlocks,
+                                          (double) voices.maxLoadPpm.load() * 1.0e-6 });
+        }
+
+        return s;
+    }
+
+    static constexpr int maxTrackedVoices = 256;
+
+private:
+    //==============================================================================
+    template <int numBins>
+    struct Histogram
+    {
+        void add (int bin) noexcept        { increase (counts[(size_t) bin], 1); }
+
+        void clear() noexcept
+        {
+            for (auto& c : counts)
+                c.store (0, std::memory_order_relaxed);
+        }
+
+        template <typename BinLimitFn>
+        Summary summarise (BinLimitFn binLimit, double sum, double max) const
+        {
+            std::array<juce::int64, numBins> copy;
+            Summary s;
+
+            for (size_t i = 0; i < (size_t) numBins; ++i)
+                s.count += (copy[i] = counts[i].load (std::memory_order_relaxed));
+
+            if (s.count == 0)
+                return s;
+
+            auto percentile = [&] (double fraction)
+            {
+                auto target = (juce::int64) std::ceil (fraction * (double) s.count);
+                juce::int64 seen = 0;
+
+                for (int i = 0; i < numBins; ++i)
+                    if ((seen += copy[(size_t) i]) >= target)
+                        return juce::jmin (binLimit (i), max);
+
+                return max;
+            };
+
+            s.mean = sum / (double) s.count;
+            s.p50 = percentile (0.5);
+            s.p90 = percentile (0.9);
+            s.p99 = percentile (0.99);
+            s.p999 = percentile (0.999);
+            s.max = max;
+            return s;
+        }
+
+        std::array<std::atomic<juce::int64>, (size_t) numBins> counts {};
+    };
+
+    // durations from 1 us to 131 ms in steps of an eighth of an octave, plus one bin below
+    static constexpr int durationBinsPerOctave = 8, numDurationBins = 1 + 17 * durationBinsPerOctave;
+    static constexpr int numLoadBins = 201;     // 1% each, the last one for 200% or more
+
+    static int getDurationBin (double micros) noexcept
+    {
+        if (micros < 1.0)
+            return 0;
+
+        return juce::jmin (numDurationBins - 1, 1 + (int) (durationBinsPerOctave * std::log2 (micros)));
+    }
+
+    static double getDurationBinLimit (int bin) noexcept
+    {
+        return std::exp2 ((double) bin / durationBinsPerOctave);
+    }
+
+    // only the audio thread writes, so a plain load and store is enough
+    static void increase (std::atomic<juce::int64>& value, juce::int64 amount) noexcept
+    {
+        value.store (value.load (std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    static void raise (std::atomic<juce::int64>& value, juce::int64 candidate) noexcept
+    {
+        if (candidate > value.load (std::memory_order_relaxed))
+            value.store (candidate, std::memory_order_relaxed);
+    }
+
+    /** Audio thread: empties everything for a reset. */
+    void clear() noexcept
+    {
+        for (auto& stage : stages)
+        {
+            stage.histogram.clear();
+            stage.sumOfNanos.store (0, std::memory_order_relaxed);
+            stage.maxNanos.store (0, std::memory_order_relaxed);
+        }
+
+        loadHistogram.clear();
+
+        for (auto* value : { &sumOfLoadPpm, &maxLoadPpm, &numNearMisses, &numOverruns })
+            value->store (0, std::memory_order_relaxed);
+
+        for (auto& voices : voiceLoads)
+            for (auto* value : { &voices.numBlocks, &voices.sumOfLoadPpm, &voices.maxLoadPpm })
+                value->store (0, std::memory_order_relaxed);
+    }
+
+    struct StageRecord
+    {
+        Histogram<numDurationBins> histogram;
+        std::atomic<juce::int64> sumOfNanos { 0 }, maxNanos { 0 };
+    };
+
+    struct VoiceRecord
+    {
+        std::atomic<juce::int64> numBlocks { 0 }, sumOfLoadPpm { 0 }, maxLoadPpm { 0 };
+    };
+
+    const double ticksPerMicrosecond;
+    std::atomic<double> sampleRate { 0.0 };
+    std::atomic<float> nearMissThreshold { 0.8f };
+    std::atomic<bool> resetPending { false };
+
+    std::array<StageRecord, numStages> stages;
+    Histogram<numLoadBins> loadHistogram;
+    std::atomic<juce::int64> sumOfLoadPpm { 0 }, maxLoadPpm { 0 };      // loads in parts per million
+    std::atomic<juce::int64> numNearMisses { 0 }, numOverruns { 0 };
+    std::array<VoiceRecord, maxTrackedVoices + 1> voiceLoads;
+    std::atomic<int> lastNumVoices { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE (BlockTelemetry)
+};
+
+//==============================================================================
+/** Writes telemetry snapshots to disk on a background thread: CSV for a
+    .csv file, JSON for anything else.
+*/
+class BlockTelemetryExporter  : private juce::Thread,
+                                private juce::AsyncUpdater
+{
+public:
+    explicit BlockTelemetryExporter (const BlockTelemetry& source)
+        : juce::Thread ("Telemetry exporter"), telemetry (source)
+    {
+    }
+
+    ~BlockTelemetryExporter() override
+    {
+        cancelPendingUpdate();
+        stopThread (4000);
+    }
+
+    /** Queues an export; a newer request replaces one that hasn't started yet. */
+    void exportTo (const juce::File& file)
+    {
+        {
+            const juce::ScopedLock sl (lock);
+            pendingFile = file;
+        }
+
+        startThread();
+        notify();
+    }
+
+    /** Called on the message thread once an export has finished or failed. */
+    std::function<void (const juce::Result&)> onExported;
+
+private:
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            juce::File file;
+
+            {
+                const juce::ScopedLock sl (lock);
+                std::swap (file, pendingFile);
+            }
+
+            if (file == juce::File())
+            {
+                wait (-1);
+                continue;
+            }
+
+            auto snapshot = telemetry.getSnapshot();
+            auto text = file.hasFileExtension ("csv") ? snapshot.toCsv() : snapshot.toJson();
+
+            {
+                const juce::ScopedLock sl (lock);
+                result = file.replaceWithText (text) ? juce::Result::ok()
+                                                     : juce::Result::fail ("Couldn't write " + file.getFullPathName());
+            }
+
+            triggerAsyncUpdate();
+        }
+    }
+
+    void handleAsyncUpdate() override
+    {
+        juce::Result r = juce::Result::ok();
+
+        {
+            const juce::ScopedLock sl (lock);
+            r = result;
+        }
+
+        if (onExported != nullptr)
+            onExported (r);
+    }
+
+    const BlockTelemetry& telemetry;
+    juce::CriticalSection lock;
+    juce::File pendingFile;
+    juce::Result result { juce::Result::ok() };
+
+    JUCE_DECLARE_NON_COPYABLE (BlockTelemetryExporter)
+};
@@ -0,0 +1,242 @@
+/*
+  ==============================================================================
+
+    Envelope.h
+
+    The attack, decay, sustain and release envelope both voice engines use.
+    Times are given in seconds and turned into per-sample rates for the
+    playback sample rate, so a release lasts as long at 96 kHz as at 44.1.
+
+    Gains come out a block at a time. Every segment is either a straight
+    line or an exponential curve whose length in samples is known as soon
+    as it starts, so the loops filling in gains never test for the end of a
+    segment and vectorise.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+class Envelope
+{
+public:
+    enum class Shape
+    {
+        linear,         // straight down to silence, like juce::ADSR
+        exponential     // a constant number of dB per second, down to silenceLevel
+    };
+
+    struct Parameters
+    {
+        float attack = 0.0f, decay = 0.0f;      // seconds
+        float sustain = 1.0f;                   // a level from 0 to 1
+        float release = 0.1f;                   // seconds
+        Shape releaseShape = Shape::linear;
+
+        bool operator== (const Parameters& other) const noexcept
+        {
+            return attack == other.attack && decay == other.decay && sustain == other.sustain
+                     && release == other.release && releaseShape == other.releaseShape;
+        }
+    };
+
+    /** Where an exponential release counts as having finished, about -46 dB. */
+    static constexpr float silenceLevel = 0.005f;
+
+    //==============================================================================
+    /** Works out the segment rates. Cheap to call again with the same settings. */
+    void prepare (const Parameters& newParameters, double sampleRate) noexcept
+    {
+        if (newParameters == parameters && sampleRate == preparedSampleRate)
+            return;
+
+        parameters = newParameters;
+        preparedSampleRate = sampleRate;
+
+        attackSamples  = juce::roundToInt (parameters.attack * sampleRate);
+        decaySamples   = juce::roundToInt (parameters.decay * sampleRate);
+        releaseSamples = juce::roundToInt (parameters.release * sampleRate);
+
+        if (parameters.releaseShape == Shape::exponential && releaseSamples > 0)
+        {
+            auto perSample = std::pow ((double) silenceLevel, 1.0 / releaseSamples);
+            auto power = 1.0;
+
+            for (auto& p : releasePowers)
+            {
+                p = (float) power;
+                power *= perSample;
+            }
+
+            logOfReleasePerSample = std::log (perSample);
+        }
+    }
+
+    void noteOn() noexcept
+    {
+        // like juce::ADSR, a retriggered note attacks from wherever it is
+        if (attackSamples > 0)
+            startLine (Segment::attack, 1.0f, 1.0f / (float) attackSamples);
+        else
+            startDecay (1.0f);
+    }
+
+    void noteOff() noexcept
+    {
+        if (segment == Segment::idle || segment == Segment::release)
+            return;
+
+        if (releaseSamples <= 0 || level <= 0.0f)
+        {
+            reset();
+        }
+        else if (parameters.releaseShape == Shape::linear)
+        {
+            segment = Segment::release;
+            samplesLeft = releaseSamples;
+            step = -level / (float) releaseSamples;
+        }
+        else
+        {
+            segment = Segment::release;
+            samplesLeft = level > silenceLevel ? (int) std::ceil (std::log (silenceLevel / level) / logOfReleasePerSample) : 0;
+
+            if (samplesLeft <= 0)
+                reset();
+        }
+    }
+
+    void reset() noexcept
+    {
+        segment = Segment::idle;
+        level = 0.0f;
+    }
+
+    bool isActive() const noexcept          { return segment != Segment::idle; }
+
+    /** True while the level stays put, so the caller can apply getLevel()
+        as one gain instead of asking for a block of them.
+    */
+    bool isSustaining() const noexcept      { return segment == Segment::sustain; }
+
+    float getLevel() const noexcept         { return level; }
+
+    //==============================================================================
+    /** Writes the next numSamples gains and advances the envelope. Returns the
+        number that belong to the note, which is only less than numSamples if
+        the release finished part way through.
+    */
+    int getNextGains (float* gains, int numSamples) noexcept
+    {
+        int done = 0;
+
+        while (done < numSamples && segment != Segment::idle)
+        {
+            auto* dest = gains + done;
+            auto remaining = numSamples - done;
+
+            if (segment == Segment::sustain)
+            {
+                juce::FloatVectorOperations::fill (dest, level, remaining);
+                return numSamples;
+            }
+
+            auto n = juce::jmin (remaining, samplesLeft);
+
+            if (segment == Segment::release && parameters.releaseShape == Shape::exponential)
+            {
+                n = juce::jmin (n, maxPowers - 1);
+                const auto start = level;
+
+                for (int i = 0; i < n; ++i)
+                    dest[i] = start * releasePowers[(size_t) (i + 1)];
+
+                level = start * releasePowers[(size_t) n];
+            }
+            else
+            {
+                const auto start = level;
+                const auto delta = step;
+
+                for (int i = 0; i < n; ++i)
+                    dest[i] = start + delta * (float) (i + 1);
+
+                level = start + delta * (float) n;
+            }
+
+            done += n;
+            samplesLeft -= n;
+
+            if (samplesLeft <= 0)
+                finishSegment();
+        }
+
+        return done;
+    }
+
+private:
+    enum class Segment
+    {
+        idle,
+        attack,
+        decay,
+        sustain,
+        release
+    };
+
+    /** Heads for target at about rate per sample, with the step adjusted to
+        land on it exactly after a whole number of samples.
+    */
+    void startLine (Segment newSegment, float target, float rate) noexcept
+    {
+        segment = newSegment;
+        samplesLeft = juce::jmax (1, (int) std::ceil (std::abs (target - level) / rate));
+        step = (target - level) / (float) samplesLeft;
+    }
+
+    void startDecay (float startLevel) noexcept
+    {
+        level = startLevel;
+
+        if (decaySamples > 0 && parameters.sustain < level)
+            startLine (Segment::decay, parameters.sustain, (level - parameters.sustain) / (float) decaySamples);
+        else
+            startSustain();
+    }
+
+    void startSustain() noexcept
+    {
+        segment = Segment::sustain;
+        level = parameters.sustain;
+    }
+
+    /** Lands exactly on the segment's end point, so rounding in the ramps
+        never carries over into the next segment.
+    */
+    void finishSegment() noexcept
+    {
+        switch (segment)
+        {
+            case Segment::attack:   startDecay (1.0f); break;
+            case Segment::decay:    startSustain(); break;
+            case Segment::release:  reset(); break;
+            case Segment::sustain:
+            case Segment::idle:
+            default:                break;
+        }
+    }
+
+    static constexpr int maxPowers = 65;
+
+    Parameters parameters;
+    double preparedSampleRate = 0.0;
+    int attackSamples = 0, decaySamples = 0, releaseSamples = 0;
+
+    std::array<float, maxPowers> releasePowers {};     // the exponential release's gain after 0..64 samples
+    double logOfReleasePerSample = 0.0;
+
+    Segment segment = Segment::idle;
+    float level = 0.0f, step = 0.0f;
+    int samplesLeft = 0;
+};
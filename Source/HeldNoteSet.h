@@ -0,0 +1,169 @@
+/*
+  ==============================================================================
+
+    HeldNoteSet.h
+
+    The set of notes currently held down, kept as a 128-bit mask plus the
+    MIDI channels holding each note. Updating it never allocates, and the
+    lowest held note is found with a single count-trailing-zeros. The set of
+    pitch classes held is kept up to date alongside, for chord analysis.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+class HeldNoteSet
+{
+public:
+    HeldNoteSet()                                        { clear(); }
+
+    void clear() noexcept
+    {
+        noteBits[0] = noteBits[1] = 0;
+        std::fill (std::begin (channelMasks), std::end (channelMasks), (juce::uint16) 0);
+        std::fill (std::begin (pitchClassCounts), std::end (pitchClassCounts), (juce::uint8) 0);
+        pitchClassSet = 0;
+    }
+
+    void noteOn (int midiChannel, int midiNoteNumber) noexcept
+    {
+        jassert (juce::isPositiveAndBelow (midiNoteNumber, 128) && juce::isPositiveAndNotGreaterThan (midiChannel, 16));
+
+        if (! isNoteHeld (midiNoteNumber))
+        {
+            auto pitchClass = midiNoteNumber % 12;
+            ++pitchClassCounts[pitchClass];
+            pitchClassSet |= (juce::uint16) (1 << pitchClass);
+        }
+
+        channelMasks[midiNoteNumber] |= (juce::uint16) (1 << (midiChannel - 1));
+        noteBits[midiNoteNumber >> 6] |= bitFor (midiNoteNumber);
+    }
+
+    void noteOff (int midiChannel, int midiNoteNumber) noexcept
+    {
+        jassert (juce::isPositiveAndBelow (midiNoteNumber, 128) && juce::isPositiveAndNotGreaterThan (midiChannel, 16));
+
+        channelMasks[midiNoteNumber] &= (juce::uint16) ~(1 << (midiChannel - 1));
+
+        // the note is only released once no channel is holding it any more
+        if (channelMasks[midiNoteNumber] == 0 && isNoteHeld (midiNoteNumber))
+        {
+            noteBits[midiNoteNumber >> 6] &= ~bitFor (midiNoteNumber);
+
+            auto pitchClass = midiNoteNumber % 12;
+
+            if (--pitchClassCounts[pitchClass] == 0)
+                pitchClassSet &= (juce::uint16) ~(1 << pitchClass);
+        }
+    }
+
+    /** Updates the set from a note on/off or all-notes-off message; anything
+        else is ignored.
+    */
+    void processMidiMessage (const juce::MidiMessage& message) noexcept
+    {
+        if (message.isNoteOn())
+        {
+            noteOn (message.getChannel(), message.getNoteNumber());
+        }
+        else if (message.isNoteOff())
+        {
+            noteOff (message.getChannel(), message.getNoteNumber());
+        }
+        else if (message.isAllNotesOff() || message.isAllSoundOff())
+        {
+            for (int note = 0; note < 128; ++note)
+                if (channelMasks[note] != 0)
+                    noteOff (message.getChannel(), note);
+        }
+    }
+
+    bool isNoteHeld (int midiNoteNumber) const noexcept
+    {
+        return (noteBits[midiNoteNumber >> 6] & bitFor (midiNoteNumber)) != 0;
+    }
+
+    /** The number of distinct notes held, however many channels hold each. */
+    int size() const noexcept
+    {
+        return juce::countNumberOfBits (noteBits[0]) + juce::countNumberOfBits (noteBits[1]);
+    }
+
+    /** Returns the lowest held note, or -1 if nothing is held. */
+    int getLowestNote() const noexcept
+    {
+        if (noteBits[0] != 0)
+            return countTrailingZeros (noteBits[0]);
+
+        if (noteBits[1] != 0)
+            return 64 + countTrailingZeros (noteBits[1]);
+
+        return -1;
+    }
+
+    /** The pitch classes held, as a 12-bit set with C in bit 0. */
+    juce::uint16 getPitchClassSet() const noexcept       { return pitchClassSet; }
+
+    /** Returns the lowest held note whose pitch class is in the given 12-bit
+        set, or -1 if there isn't one.
+    */
+    int getLowestNoteInPitchClasses (juce::uint16 pitchClasses) const noexcept
+    {
+        juce::uint64 lowMask = 0, highMask = 0;
+
+        for (int pitchClass = 0; pitchClass < 12; ++pitchClass)
+        {
+            if ((pitchClasses & (1 << pitchClass)) != 0)
+            {
+                // notes 64 and up start on E, four pitch classes above C
+                lowMask  |= everyTwelfthBit << pitchClass;
+                highMask |= everyTwelfthBit << ((pitchClass + 8) % 12);
+            }
+        }
+
+        if ((noteBits[0] & lowMask) != 0)
+            return countTrailingZeros (noteBits[0] & lowMask);
+
+        if ((noteBits[1] & highMask) != 0)
+            return 64 + countTrailingZeros (noteBits[1] & highMask);
+
+        return -1;
+    }
+
+private:
+    static constexpr juce::uint64 everyTwelfthBit = 0x1001001001001001ull;
+
+    static juce::uint64 bitFor (int midiNoteNumber) noexcept
+    {
+        return (juce::uint64) 1 << (midiNoteNumber & 63);
+    }
+
+    static int countTrailingZeros (juce::uint64 value) noexcept
+    {
+        jassert (value != 0);
+
+       #if JUCE_MSVC && JUCE_64BIT
+        unsigned long index;
+        _BitScanForward64 (&index, value);
+        return (int) index;
+       #elif JUCE_MSVC
+        unsigned long index;
+
+        if (_BitScanForward (&index, (unsigned long) value))
+            return (int) index;
+
+        _BitScanForward (&index, (unsigned long) (value >> 32));
+        return 32 + (int) index;
+       #else
+        return __builtin_ctzll (value);
+       #endif
+    }
+
+    juce::uint64 noteBits[2];
+    juce::uint16 channelMasks[128];
+    juce::uint8 pitchClassCounts[12];
+    juce::uint16 pitchClassSet;
+};
@@ -0,0 +1,329 @@
+/*
+  ==============================================================================
+
+    MidiIngestion.h
+
+    Gets MIDI from the input devices and the on-screen keyboard to the audio
+    thread without a lock. Every device has a preallocated queue of its own,
+    so each queue has one thread writing and one reading, and the audio
+    thread empties them without locking or allocating. Events keep the
+    devices' high-resolution timestamps, which are turned into sample
+    offsets one block later, so notes keep their spacing within a block
+    instead of all landing at its start.
+
+    The audio callbacks don't come at exactly even times, and the audio
+    clock drifts against the system clock the timestamps use, so the block
+    times are smoothed by a delay-locked loop, as described in Fons
+    Adriaensen's "Using a DLL to filter time", before the timestamps are
+    mapped onto them.
+
+    The keyboard state is only ever touched on the message thread: notes
+    played on the on-screen keyboard are queued for the audio thread, and
+    notes arriving from devices or the host are queued by the audio thread
+    for a timer to show on the keyboard.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+/** A queue of short MIDI messages with one thread writing to it and another
+    reading from it. Nothing allocates after construction.
+*/
+class MidiEventQueue
+{
+public:
+    struct Event
+    {
+        double timestamp;       // seconds, on the Time::getMillisecondCounterHiRes() clock
+        juce::uint8 data[3];
+        juce::uint8 size;
+    };
+
+    explicit MidiEventQueue (int capacity = 1024)
+        : fifo (capacity), events ((size_t) capacity) {}
+
+    /** Writer: returns false, dropping the message, if it's a SysEx or the
+        queue is full.
+    */
+    bool push (const juce::uint8* data, int size, double timestamp) noexcept
+    {
+        if (size <= 0 || size > 3)
+            return false;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite (1, start1, size1, start2, size2);
+
+        if (size1 == 0)
+            return false;
+
+        auto& event = events[(size_t) start1];
+        event.timestamp = timestamp;
+        event.size = (juce::uint8) size;
+        std::copy (data, data + size, event.data);
+
+        fifo.finishedWrite (1);
+        return true;
+    }
+
+    bool push (const juce::MidiMessage& message) noexcept
+    {
+        return push (message.getRawData(), message.getRawDataSize(), message.getTimeStamp());
+    }
+
+    /** Reader: the oldest event, or nullptr if the queue is empty. */
+    const Event* peek() const noexcept
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead (1, start1, size1, start2, size2);
+        return size1 > 0 ? &events[(size_t) start1] : nullptr;
+    }
+
+    /** Reader: removes the event peek() returned. */
+    void pop() noexcept
+    {
+        fifo.finishedRead (1);
+    }
+
+private:
+    juce::AbstractFifo fifo;
+    std::vector<Event> events;
+
+    JUCE_DECLARE_NON_COPYABLE (MidiEventQueue)
+};
+
+//==============================================================================
+class MidiIngestion  : public juce::MidiInputCallback,
+                       private juce::MidiKeyboardState::Listener,
+                       private juce::Timer
+{
+public:
+    /** The most input devices that can be connected over the object's lifetime. */
+    static constexpr int maxInputs = 16;
+
+    explicit MidiIngestion (juce::MidiKeyboardState& state)
+        : keyboardState (state)
+    {
+        keyboardState.addListener (this);
+
+        if (showsNotes)
+            startTimerHz (60);
+    }
+
+    ~MidiIngestion() override
+    {
+        stopTimer();
+        keyboardState.removeListener (this);
+    }
+
+    /** Message thread: gives a device a queue of its own. Call this before
+        adding this object as the device's callback. Returns false if every
+        queue has been taken by other devices.
+    */
+    bool addInput (const juce::String& identifier)
+    {
+        auto numUsed = numInputs.load();
+
+        for (int i = 0; i < numUsed; ++i)
+            if (inputs[(size_t) i].identifier == identifier)
+                return true;
+
+        if (numUsed == maxInputs)
+            return false;
+
+        inputs[(size_t) numUsed].identifier = identifier;
+        numInputs.store (numUsed + 1, std::memory_order_release);   // publishes the identifier
+        return true;
+    }
+
+    /** MIDI thread: queues the message for the audio thread. */
+    void handleIncomingMidiMessage (juce::MidiInput* source, const juce::MidiMessage& message) override
+    {
+        if (auto* queue = findQueue (source))
+            if (queue->push (message))
+                return;
+
+        ++numDropped;
+    }
+
+    /** The number of messages dropped because they were SysEx, came from a
+        device without a queue, or found its queue full.
+    */
+    int getNumDroppedMessages() const noexcept      { return numDropped.load(); }
+
+    //==============================================================================
+    /** Audio thread: starts the block clock over. */
+    void reset (double newSampleRate) noexcept
+    {
+        sampleRate = newSampleRate;
+        clockRunning = false;
+    }
+
+    /** Audio thread, live path: moves every event timestamped before this
+        block's start into midi, offset by one block so events keep their
+        spacing, and queues the devices' notes to be shown on the keyboard.
+    */
+    void collectLiveBlock (juce::MidiBuffer& midi, int numSamples) noexcept
+    {
+        updateBlockClock (juce::Time::getMillisecondCounterHiRes() * 0.001, numSamples);
+
+        auto span = nextBlockStart - blockStart;
+        auto samplesPerSecond = numSamples / span;
+        auto windowStart = blockStart - span;
+
+        auto collect = [&] (MidiEventQueue& queue, bool display)
+        {
+            while (auto* event = queue.peek())
+            {
+                auto offset = (int) ((event->timestamp - windowStart) * samplesPerSecond);
+
+                // anything after this block started belongs to the next one
+                if (offset >= numSamples)
+                    break;
+
+                midi.addEvent (event->data, event->size, juce::jmax (0, offset));
+
+                if (display && showsNotes)
+                    displayQueue.push (event->data, event->size, event->timestamp);
+
+                queue.pop();
+            }
+        };
+
+        for (int i = numInputs.load (std::memory_order_acquire); --i >= 0;)
+            collect (inputs[(size_t) i].queue, true);
+
+        collect (keyboardQueue, false);
+    }
+
+    /** Audio thread, for MIDI that comes with the block, e.g. from a host:
+        queues its notes to be shown on the keyboard. If anything's been
+        played on the keyboard, fills merged with midi followed by those
+        notes at the start of the block, and returns true; otherwise leaves
+        merged alone and returns false.
+
+        The host's buffer is never added to, since it may not have room to
+        spare; merged should have been given enough with MidiBuffer::ensureSize()
+        for a block's events, or it allocates.
+    */
+    bool collectKeyboard (const juce::MidiBuffer& midi, juce::MidiBuffer& merged, int startSample) noexcept
+    {
+        if (showsNotes)
+            for (const auto metadata : midi)
+                displayQueue.push (metadata.data, metadata.numBytes, 0.0);
+
+        if (keyboardQueue.peek() == nullptr)
+            return false;
+
+        merged.clear();
+        merged.addEvents (midi, 0, -1, 0);
+
+        while (auto* event = keyboardQueue.peek())
+        {
+            merged.addEvent (event->data, event->size, startSample);
+            keyboardQueue.pop();
+        }
+
+        return true;
+    }
+
+private:
+    struct Input
+    {
+        juce::String identifier;    // written before it's published by numInputs, then never again
+        MidiEventQueue queue;
+    };
+
+    MidiEventQueue* findQueue (juce::MidiInput* source) noexcept
+    {
+        if (source == nullptr)
+            return nullptr;
+
+        auto identifier = source->getIdentifier();
+
+        for (int i = numInputs.load (std::memory_order_acquire); --i >= 0;)
+            if (inputs[(size_t) i].identifier == identifier)
+                return &inputs[(size_t) i].queue;
+
+        return nullptr;
+    }
+
+    /** Moves the smoothed block start on by one block, or starts it at now
+        after a reset or a gap, like the device stopping, that the loop
+        shouldn't try to follow.
+    */
+    void updateBlockClock (double now, int numSamples) noexcept
+    {
+        auto period = numSamples / sampleRate;
+        auto error = now - nextBlockStart;
+
+        if (! clockRunning || std::abs (error) > resyncPeriods * period)
+        {
+            blockStart = now;
+            nextBlockStart = now + period;
+            secondsPerSample = 1.0 / sampleRate;
+            clockRunning = true;
+            return;
+        }
+
+        // a second-order loop: the error nudges the next block's time and,
+        // more slowly, the estimate of how long a sample really lasts
+        auto omega = juce::MathConstants<double>::twoPi * loopBandwidthHz * period;
+        blockStart = nextBlockStart;
+        nextBlockStart += juce::MathConstants<double>::sqrt2 * omega * error + secondsPerSample * numSamples;
+        secondsPerSample += omega * omega * error / numSamples;
+    }
+
+    void handleNoteOn (juce::MidiKeyboardState*, int midiChannel, int midiNoteNumber, float velocity) override
+    {
+        if (! showingNotes)
+            keyboardQueue.push (juce::MidiMessage::noteOn (midiChannel, midiNoteNumber, velocity)
+                                  .withTimeStamp (juce::Time::getMillisecondCounterHiRes() * 0.001));
+    }
+
+    void handleNoteOff (juce::MidiKeyboardState*, int midiChannel, int midiNoteNumber, float velocity) override
+    {
+        if (! showingNotes)
+            keyboardQueue.push (juce::MidiMessage::noteOff (midiChannel, midiNoteNumber, velocity)
+                                  .withTimeStamp (juce::Time::getMillisecondCounterHiRes() * 0.001));
+    }
+
+    /** Shows the notes from devices and the host on the keyboard. The keyboard
+        state calls its listeners, this one included, so those calls are
+        ignored while it happens, or the notes would come back as the
+        keyboard's own.
+    */
+    void timerCallback() override
+    {
+        const juce::ScopedValueSetter<bool> showing (showingNotes, true);
+
+        while (auto* event = displayQueue.peek())
+        {
+            keyboardState.processNextMidiEvent (juce::MidiMessage (event->data, event->size));
+            displayQueue.pop();
+        }
+    }
+
+    static constexpr double loopBandwidthHz = 1.0;
+    static constexpr double resyncPeriods = 4.0;
+
+    juce::MidiKeyboardState& keyboardState;
+
+    // headless users, like the offline renderer, have no keyboard to show notes on
+    const bool showsNotes = juce::MessageManager::getInstanceWithoutCreating() != nullptr;
+
+    std::array<Input, maxInputs> inputs;
+    std::atomic<int> numInputs { 0 };
+    std::atomic<int> numDropped { 0 };
+    MidiEventQueue keyboardQueue;       // message thread to audio thread
+    MidiEventQueue displayQueue;        // audio thread to message thread
+    bool showingNotes = false;          // message thread only
+
+    // audio thread only
+    double sampleRate = 44100.0;
+    bool clockRunning = false;
+    double blockStart = 0.0, nextBlockStart = 0.0, secondsPerSample = 0.0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MidiIngestion)
+};
@@ -0,0 +1,127 @@
+/*
+  ==============================================================================
+
+    This file contains the startup code for the headless offline renderer.
+
+    Usage:
+        OfflineRender [--rate 44100] [--block 512] [--limit 1|2|3] [--reference lowest|root|consonant]
+                      [--scala scale.scl] [--sample piano.wav|piano.sfz] [--piano] [--tail 2.0] [--jobs N]
+                      [--compare referenceFolder] [--tolerance -90]
+                      --out outputFolder file1.mid [file2.mid ...]
+        OfflineRender --check-tuning [--cents 1] [--rate 44100]
+
+    With --compare, each render is checked against the WAV of the same name
+    in referenceFolder, and the exit code is non-zero if any differs by more
+    than --tolerance dB relative to full scale.
+
+    --check-tuning renders no files. It plays just intervals on the sine and
+    on a multi-zone sampled instrument in every limit, and the exit code is
+    non-zero if any note's measured frequency is more than --cents away from
+    its just ratio.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "OfflineRenderer.h"
+
+//==============================================================================
+static void printUsage()
+{
+    std::cout << "Usage: OfflineRender [--rate 44100] [--block 512] [--limit 1|2|3] [--reference lowest|root|consonant]" << std::endl
+              << "                     [--scala scale.scl] [--sample piano.wav|piano.sfz] [--storage float32|int16|half]" << std::endl
+              << "                     [--piano] [--tail 2.0] [--jobs N] [--compare referenceFolder] [--tolerance -90]" << std::endl
+              << "                     --out outputFolder file1.mid [file2.mid ...]" << std::endl
+              << "       OfflineRender --check-tuning [--cents 1] [--rate 44100]" << std::endl;
+}
+
+int main (int argc, char* argv[])
+{
+    juce::StringArray args;
+
+    for (int i = 1; i < argc; ++i)
+        args.add (juce::CharPointer_UTF8 (argv[i]));
+
+    OfflineRenderSettings settings;
+    auto outputDirectory = juce::File::getCurrentWorkingDirectory();
+    auto numThreads = juce::SystemStats::getNumCpus();
+    juce::Array<juce::File> midiFiles;
+    auto checkingTuning = false;
+    auto toleranceCents = 1.0;
+
+    for (int i = 0; i < args.size(); ++i)
+    {
+        auto arg = args[i];
+        auto hasValue = i + 1 < args.size();
+
+        if      (arg == "--rate"   && hasValue)  settings.sampleRate = args[++i].getDoubleValue();
+        else if (arg == "--block"  && hasValue)  settings.blockSize = args[++i].getIntValue();
+        else if (arg == "--limit"  && hasValue)  settings.tuningLimit = args[++i].getIntValue();
+        else if (arg == "--reference" && hasValue && TuningReference::parseName (args[i + 1], settings.referenceStrategy))  ++i;
+        else if (arg == "--scala"  && hasValue)  settings.scalaFile = juce::File::getCurrentWorkingDirectory().getChildFile (args[++i]);
+        else if (arg == "--sample" && hasValue)  settings.sampleFile = juce::File::getCurrentWorkingDirectory().getChildFile (args[++i]);
+        else if (arg == "--piano")               settings.additivePiano = true;
+        else if (arg == "--tail"   && hasValue)  settings.tailSeconds = args[++i].getDoubleValue();
+        else if (arg == "--storage" && hasValue && SampleStorage::parseName (args[i + 1], settings.sampleStorage))  ++i;
+        else if (arg == "--jobs"   && hasValue)  numThreads = args[++i].getIntValue();
+        else if (arg == "--compare" && hasValue) settings.referenceDirectory = juce::File::getCurrentWorkingDirectory().getChildFile (args[++i]);
+        else if (arg == "--tolerance" && hasValue)  settings.referenceToleranceDb = args[++i].getDoubleValue();
+        else if (arg == "--check-tuning")        checkingTuning = true;
+        else if (arg == "--cents"  && hasValue)  toleranceCents = args[++i].getDoubleValue();
+        else if (arg == "--out"    && hasValue)  outputDirectory = juce::File::getCurrentWorkingDirectory().getChildFile (args[++i]);
+        else if (arg.startsWith ("--"))
+        {
+            printUsage();
+            return 1;
+        }
+        else
+        {
+            midiFiles.add (juce::File::getCurrentWorkingDirectory().getChildFile (arg));
+        }
+    }
+
+    if (checkingTuning && settings.sampleRate > 0.0)
+    {
+        auto result = OfflineRenderer::checkTuning (settings.sampleRate, toleranceCents);
+
+        if (result.failed())
+        {
+            std::cerr << result.getErrorMessage() << std::endl;
+            return 1;
+        }
+
+        std::cout << "Every note is within " << toleranceCents << " cents of its just ratio" << std::endl;
+        return 0;
+    }
+
+    if (midiFiles.isEmpty() || settings.sampleRate <= 0.0 || settings.blockSize <= 0)
+    {
+        printUsage();
+        return 1;
+    }
+
+    OfflineRenderer renderer (settings);
+    auto startTime = juce::Time::getMillisecondCounterHiRes();
+    auto results = renderer.renderAll (midiFiles, outputDirectory, numThreads);
+    auto elapsedSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) * 0.001;
+    int numFailed = 0;
+
+    for (int i = 0; i < results.size(); ++i)
+    {
+        if (results[i].failed())
+        {
+            std::cerr << results[i].getErrorMessage() << std::endl;
+            ++numFailed;
+        }
+        else
+        {
+            std::cout << (settings.referenceDirectory != juce::File() ? "Matched " : "Rendered ")
+                      << midiFiles[i].getFileName() << std::endl;
+        }
+    }
+
+    std::cout << results.size() - numFailed << " of " << results.size()
+              << " files rendered in " << elapsedSeconds << " s" << std::endl;
+
+    return numFailed == 0 ? 0 : 1;
+}
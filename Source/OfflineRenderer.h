@@ -0,0 +1,468 @@
+/*
+  ==============================================================================
+
+    OfflineRenderer.h
+
+    Renders Standard MIDI Files through SynthAudioSource straight to WAV,
+    without an audio device or a GUI. Rendering runs as fast as the CPU allows,
+    and a batch of files can be spread across a ThreadPool.
+
+    Each render can also be checked against a reference WAV rendered earlier,
+    so a folder of short MIDI files and their known-good renders catches any
+    change in what the engine plays: a note retuned by even a cent drifts
+    a quarter of a cycle from its reference within a second at 440 Hz.
+
+    References only show that nothing has changed, not that it was right to
+    begin with, so checkTuning() measures what the engine plays against the
+    just ratios themselves, for every limit and for both the sine and the
+    sampler, with a sampled instrument whose zones have different roots and
+    were recorded at another rate than the one rendered at.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "SynthAudioSource.h"
+#include "ScalaTuning.h"
+
+//==============================================================================
+struct OfflineRenderSettings
+{
+    double sampleRate = 44100.0;
+    int blockSize = 512;
+    int numChannels = 2;
+    int bitsPerSample = 24;
+    int tuningLimit = 0;         // 0 leaves the engine's default, otherwise 1..3 as in the limit menu
+    juce::File scalaFile;        // a .scl file (plus a .kbm of the same name) that overrides tuningLimit
+    TuningReference::Strategy referenceStrategy = TuningReference::Strategy::lowestNote;
+    juce::File sampleFile;       // if this doesn't exist the sine wave sound is used
+    bool additivePiano = false;  // plays the additive piano instead of the sine wave, if there's no sample
+    SampleStorage::Format sampleStorage = SampleStorage::Format::float32;
+    double tailSeconds = 2.0;    // extra time rendered after the last MIDI event
+    juce::File referenceDirectory;          // if set, each render is compared with the WAV of the same name in here
+    double referenceToleranceDb = -90.0;    // the largest difference from the reference allowed, relative to full scale
+};
+
+//==============================================================================
+class OfflineRenderer
+{
+public:
+    OfflineRenderer (const OfflineRenderSettings& s) : settings (s) {}
+
+    /** Renders one MIDI file into one WAV file, overwriting it if it exists. */
+    juce::Result render (const juce::File& midiFile, const juce::File& wavFile) const
+    {
+        juce::MidiMessageSequence sequence;
+        auto result = readMidiFile (midiFile, sequence);
+
+        if (result.failed())
+            return result;
+
+        juce::MidiKeyboardState keyboardState;
+        SynthAudioSource source (keyboardState);
+
+        if (settings.sampleFile.existsAsFile())
+        {
+            source.getSampleLoader().setStorageFormat (settings.sampleStorage);
+
+            if (! source.loadSampledSound (settings.sampleFile))
+                return juce::Result::fail ("Couldn't read sample " + settings.sampleFile.getFullPathName());
+        }
+        else if (settings.additivePiano)
+        {
+            source.setUsingPianoSound();
+        }
+
+        if (settings.tuningLimit != 0)
+            source.setTuningLimit (settings.tuningLimit);
+
+        source.setReferenceStrategy (settings.referenceStrategy);
+
+        if (settings.scalaFile != juce::File())
+        {
+            ScalaScale scale;
+            ScalaKeyboardMapping mapping;
+            auto mappingFile = settings.scalaFile.withFileExtension ("kbm");
+            auto hasMapping = mappingFile.existsAsFile();
+
+            result = ScalaScale::load (settings.scalaFile, scale);
+
+            if (result.wasOk() && hasMapping)
+                result = ScalaKeyboardMapping::load (mappingFile, mapping);
+
+            if (result.failed())
+                return result;
+
+            source.setTuningTable (ScalaTuning::compile (scale, hasMapping ? &mapping : nullptr));
+        }
+
+        source.prepareToPlay (settings.blockSize, settings.sampleRate);
+
+        wavFile.deleteFile();
+        std::unique_ptr<juce::FileOutputStream> stream (wavFile.createOutputStream());
+
+        if (stream == nullptr)
+            return juce::Result::fail ("Couldn't write to " + wavFile.getFullPathName());
+
+        juce::WavAudioFormat wavFormat;
+        std::unique_ptr<juce::AudioFormatWriter> writer (wavFormat.createWriterFor (stream.get(), settings.sampleRate,
+                                                                                    (unsigned int) settings.numChannels,
+                                                                                    settings.bitsPerSample, {}, 0));
+        if (writer == nullptr)
+            return juce::Result::fail ("Unsupported WAV format for " + wavFile.getFullPathName());
+
+        stream.release(); // the writer owns the stream now
+
+        auto totalSamples = juce::roundToInt64 ((sequence.getEndTime() + settings.tailSeconds) * settings.sampleRate);
+        juce::AudioBuffer<float> buffer (settings.numChannels, settings.blockSize);
+        juce::MidiBuffer midi;
+        int nextEvent = 0;
+
+        for (juce::int64 position = 0; position < totalSamples; position += settings.blockSize)
+        {
+            auto numSamples = (int) juce::jmin ((juce::int64) settings.blockSize, totalSamples - position);
+
+            midi.clear();
+
+            while (nextEvent < sequence.getNumEvents())
+            {
+                auto& message = sequence.getEventPointer (nextEvent)->message;
+                auto samplePosition = juce::roundToInt64 (message.getTimeStamp() * settings.sampleRate);
+
+                if (samplePosition >= position + numSamples)
+                    break;
+
+                if (! message.isMetaEvent())
+                    midi.addEvent (message, (int) juce::jmax ((juce::int64) 0, samplePosition - position));
+
+                ++nextEvent;
+            }
+
+            buffer.clear();
+            source.renderNextBlock (buffer, midi, 0, numSamples);
+
+            if (! writer->writeFromAudioSampleBuffer (buffer, 0, numSamples))
+                return juce::Result::fail ("Write failed for " + wavFile.getFullPathName());
+        }
+
+        return juce::Result::ok();
+    }
+
+    /** Renders each MIDI file to a WAV of the same name in outputDirectory,
+        using up to numThreads files at a time. Returns one Result per file,
+        in the same order as midiFiles.
+    */
+    juce::Array<juce::Result> renderAll (const juce::Array<juce::File>& midiFiles,
+                                         const juce::File& outputDirectory,
+                                         int numThreads) const
+    {
+        juce::Array<juce::Result> results;
+        results.insertMultiple (0, juce::Result::ok(), midiFiles.size());
+
+        if (midiFiles.isEmpty())
+            return results;
+
+        outputDirectory.createDirectory();
+
+        juce::ThreadPool pool (juce::jlimit (1, midiFiles.size(), numThreads));
+        juce::WaitableEvent allDone;
+        std::atomic<int> remaining { midiFiles.size() };
+
+        for (int i = 0; i < midiFiles.size(); ++i)
+        {
+            pool.addJob ([this, i, &midiFiles, &outputDirectory, &results, &remaining, &allDone]
+            {
+                auto midiFile = midiFiles.getReference (i);
+                auto wavName = midiFile.getFileNameWithoutExtension() + ".wav";
+                auto result = render (midiFile, outputDirectory.getChildFile (wavName));
+
+                if (result.wasOk() && settings.referenceDirectory != juce::File())
+                    result = compareWithReference (outputDirectory.getChildFile (wavName),
+                                                   settings.referenceDirectory.getChildFile (wavName),
+                                                   settings.referenceToleranceDb);
+
+                results.getReference (i) = result;
+
+                if (--remaining == 0)
+                    allDone.signal();
+            });
+        }
+
+        allDone.wait();
+        return results;
+    }
+
+    /** Fails if the two WAVs differ in length, channels or sample rate, or if
+        any sample differs by more than toleranceDb relative to full scale.
+    */
+    static juce::Result compareWithReference (const juce::File& rendered, const juce::File& reference, double toleranceDb)
+    {
+        if (! reference.existsAsFile())
+            return juce::Result::fail ("No reference render " + reference.getFullPathName());
+
+        juce::WavAudioFormat wavFormat;
+        std::unique_ptr<juce::AudioFormatReader> actual (wavFormat.createReaderFor (rendered.createInputStream().release(), true));
+        std::unique_ptr<juce::AudioFormatReader> expected (wavFormat.createReaderFor (reference.createInputStream().release(), true));
+
+        if (expected == nullptr)
+            return juce::Result::fail ("Couldn't read reference " + reference.getFullPathName());
+
+        if (actual == nullptr)
+            return juce::Result::fail ("Couldn't read back " + rendered.getFullPathName());
+
+        if (actual->lengthInSamples != expected->lengthInSamples || actual->numChannels != expected->numChannels
+             || actual->sampleRate != expected->sampleRate)
+            return juce::Result::fail (rendered.getFileName() + " doesn't match the length, channels or sample rate of "
+                                         + reference.getFullPathName());
+
+        constexpr int chunkSize = 8192;
+        auto numChannels = (int) actual->numChannels;
+        juce::AudioBuffer<float> actualChunk (numChannels, chunkSize), expectedChunk (numChannels, chunkSize);
+        auto worstDifference = 0.0f;
+        juce::int64 worstPosition = 0;
+
+        for (juce::int64 position = 0; position < actual->lengthInSamples; position += chunkSize)
+        {
+            auto numSamples = (int) juce::jmin ((juce::int64) chunkSize, actual->lengthInSamples - position);
+            actual->read (&actualChunk, 0, numSamples, position, true, true);
+            expected->read (&expectedChunk, 0, numSamples, position, true, true);
+
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                auto* a = actualChunk.getReadPointer (channel);
+                auto* e = expectedChunk.getReadPointer (channel);
+
+                for (int i = 0; i < numSamples; ++i)
+                {
+                    auto difference = std::abs (a[i] - e[i]);
+
+                    if (difference > worstDifference)
+                    {
+                        worstDifference = difference;
+                        worstPosition = position + i;
+                    }
+                }
+            }
+        }
+
+        auto worstDb = juce::Decibels::gainToDecibels (worstDifference, -200.0f);
+
+        if (worstDb > toleranceDb)
+            return juce::Result::fail (rendered.getFileName() + " differs from its reference by " + juce::String (worstDb, 1)
+                                         + " dB at " + juce::String ((double) worstPosition / actual->sampleRate, 3) + " s");
+
+        return juce::Result::ok();
+    }
+
+    /** Plays pairs of notes, the second started a just interval above the
+        first while it's held, and measures each one once it's sounding
+        alone. The first should be at its equal tempered pitch and the
+        second at the first's times the interval's ratio in the limit's
+        scale. Fails, listing every note that's out, if any is more than
+        toleranceCents away.
+    */
+    static juce::Result checkTuning (double sampleRate, double toleranceCents)
+    {
+        auto directory = juce::File::getSpecialLocation (juce::File::tempDirectory)
+                            .getNonexistentChildFile ("AdaptiveTuningCheck", {}, false);
+        auto instrument = directory.getChildFile ("zones.sfz");
+        auto result = createTestInstrument (instrument);
+        juce::StringArray errors;
+
+        const JustIntonation::Scale* scales[] = { &JustIntonation::threeLimit, &JustIntonation::fiveLimit, &JustIntonation::sevenLimit };
+
+        for (int limitId = 1; limitId <= 3 && result.wasOk(); ++limitId)
+        {
+            for (auto sampled : { false, true })
+            {
+                for (auto interval : testIntervals)
+                {
+                    auto secondNote = firstTestNote + interval;
+                    auto ratio = (*scales[limitId - 1])[(size_t) (interval % 12)].toDouble() * (1 << (interval / 12));
+                    double expected[] = { juce::MidiMessage::getMidiNoteInHertz (firstTestNote), 0.0 };
+                    expected[1] = expected[0] * ratio;
+
+                    double measured[2];
+                    result = renderTestNotes (limitId, sampled ? instrument : juce::File(), secondNote, sampleRate, measured);
+
+                    if (result.failed())
+                        break;
+
+                    for (int i = 0; i < 2; ++i)
+                    {
+                        auto cents = measured[i] > 0.0 ? 1200.0 * std::log2 (measured[i] / expected[i]) : 1200.0;
+
+                        if (std::abs (cents) > toleranceCents)
+                            errors.add (juce::String (limitId == 1 ? 3 : limitId == 2 ? 5 : 7) + "-limit "
+                                          + (sampled ? "sampler" : "sine") + ", note " + juce::String (i == 0 ? firstTestNote : secondNote)
+                                          + " after " + juce::String (firstTestNote) + ": " + juce::String (measured[i], 3)
+                                          + " Hz, expected " + juce::String (expected[i], 3) + " Hz ("
+                                          + (cents >= 0.0 ? "+" : "") + juce::String (cents, 2) + " cents)");
+                    }
+                }
+            }
+        }
+
+        directory.deleteRecursively();
+
+        if (result.failed())
+            return result;
+
+        return errors.isEmpty() ? juce::Result::ok() : juce::Result::fail (errors.joinIntoString ("\n"));
+    }
+
+    /** Writes an .sfz with two sine wave zones, one rooted on middle C for
+        the first note and one a fifth above it for the second, recorded at
+        testSampleRate. The zones are the same every time, so renders with
+        them can be compared with references.
+    */
+    static juce::Result createTestInstrument (const juce::File& sfzFile)
+    {
+        const struct { int rootNote, lowKey, highKey; } zones[] = { { 60, 0, 63 }, { 67, 64, 127 } };
+        auto directory = sfzFile.getParentDirectory();
+        juce::String sfz;
+
+        if (! directory.createDirectory())
+            return juce::Result::fail ("Couldn't create " + directory.getFullPathName());
+
+        for (auto& zone : zones)
+        {
+            auto wavFile = directory.getChildFile ("sine" + juce::String (zone.rootNote) + ".wav");
+            juce::AudioBuffer<float> sine (1, (int) (2.0 * testSampleRate));
+            auto cyclesPerSample = juce::MidiMessage::getMidiNoteInHertz (zone.rootNote) / testSampleRate;
+
+            for (int i = 0; i < sine.getNumSamples(); ++i)
+                sine.setSample (0, i, 0.5f * (float) std::sin (juce::MathConstants<double>::twoPi * cyclesPerSample * i));
+
+            juce::WavAudioFormat wavFormat;
+            std::unique_ptr<juce::FileOutputStream> stream (wavFile.createOutputStream());
+            std::unique_ptr<juce::AudioFormatWriter> writer (stream != nullptr ? wavFormat.createWriterFor (stream.get(), testSampleRate, 1, 24, {}, 0)
+                                                                               : nullptr);
+            if (writer == nullptr)
+                return juce::Result::fail ("Couldn't write " + wavFile.getFullPathName());
+
+            stream.release(); // the writer owns the stream now
+
+            if (! writer->writeFromAudioSampleBuffer (sine, 0, sine.getNumSamples()))
+                return juce::Result::fail ("Couldn't write " + wavFile.getFullPathName());
+
+            sfz << "<region> sample=" << wavFile.getFileName() << " lokey=" << zone.lowKey << " hikey=" << zone.highKey
+                << " pitch_keycenter=" << zone.rootNote << "\n";
+        }
+
+        if (! sfzFile.replaceWithText (sfz))
+            return juce::Result::fail ("Couldn't write " + sfzFile.getFullPathName());
+
+        return juce::Result::ok();
+    }
+
+private:
+    static constexpr int firstTestNote = 60;
+    static constexpr int testIntervals[] = { 7, 10, 16 };   // a fifth, a minor seventh and a major tenth
+    static constexpr double testSampleRate = 48000.0;
+
+    /** Holds firstTestNote, adds secondNote half a second later and lets go
+        of the first soon after, then measures the first while it's alone
+        and the second once the first's release has died away.
+    */
+    static juce::Result renderTestNotes (int limitId, const juce::File& sampleFile, int secondNote,
+                                         double sampleRate, double* measured)
+    {
+        juce::MidiKeyboardState keyboardState;
+        SynthAudioSource source (keyboardState);
+
+        if (sampleFile != juce::File() && ! source.loadSampledSound (sampleFile))
+            return juce::Result::fail ("Couldn't load the test instrument " + sampleFile.getFullPathName());
+
+        source.setTuningLimit (limitId);
+
+        constexpr int blockSize = 512;
+        source.prepareToPlay (blockSize, sampleRate);
+
+        auto toSamples = [sampleRate] (double seconds) { return juce::roundToInt (seconds * sampleRate); };
+
+        juce::MidiMessageSequence sequence;
+        sequence.addEvent (juce::MidiMessage::noteOn (1, firstTestNote, 0.8f), 0.0);
+        sequence.addEvent (juce::MidiMessage::noteOn (1, secondNote, 0.8f), toSamples (0.5));
+        sequence.addEvent (juce::MidiMessage::noteOff (1, firstTestNote), toSamples (0.6));
+
+        juce::AudioBuffer<float> output (2, toSamples (1.4));
+        juce::AudioBuffer<float> block (2, blockSize);
+        juce::MidiBuffer midi;
+        int nextEvent = 0;
+
+        for (int position = 0; position < output.getNumSamples(); position += blockSize)
+        {
+            auto numSamples = juce::jmin (blockSize, output.getNumSamples() - position);
+            midi.clear();
+
+            for (; nextEvent < sequence.getNumEvents(); ++nextEvent)
+            {
+                auto& message = sequence.getEventPointer (nextEvent)->message;
+                auto samplePosition = (int) message.getTimeStamp();
+
+                if (samplePosition >= position + numSamples)
+                    break;
+
+                midi.addEvent (message, samplePosition - position);
+            }
+
+            block.clear();
+            source.renderNextBlock (block, midi, 0, numSamples);
+
+            for (int channel = 0; channel < 2; ++channel)
+                output.copyFrom (channel, position, block, channel, 0, numSamples);
+        }
+
+        measured[0] = measureFrequency (output.getReadPointer (0, toSamples (0.1)), toSamples (0.4), sampleRate);
+        measured[1] = measureFrequency (output.getReadPointer (0, toSamples (0.85)), toSamples (0.5), sampleRate);
+        return juce::Result::ok();
+    }
+
+    /** The frequency of a steady tone, from the time between its first and
+        last upward zero crossings, each placed between samples by linear
+        interpolation. Returns 0 if there are fewer than two.
+    */
+    static double measureFrequency (const float* samples, int numSamples, double sampleRate) noexcept
+    {
+        double first = 0.0, last = 0.0;
+        int numCrossings = 0;
+
+        for (int i = 1; i < numSamples; ++i)
+        {
+            if (samples[i - 1] < 0.0f && samples[i] >= 0.0f)
+            {
+                last = (i - 1) + samples[i - 1] / (double) (samples[i - 1] - samples[i]);
+
+                if (numCrossings++ == 0)
+                    first = last;
+            }
+        }
+
+        return numCrossings > 1 ? (numCrossings - 1) * sampleRate / (last - first) : 0.0;
+    }
+
+    static juce::Result readMidiFile (const juce::File& midiFile, juce::MidiMessageSequence& sequence)
+    {
+        juce::FileInputStream input (midiFile);
+
+        if (! input.openedOk())
+            return juce::Result::fail ("Couldn't open " + midiFile.getFullPathName());
+
+        juce::MidiFile file;
+
+        if (! file.readFrom (input))
+            return juce::Result::fail ("Not a valid MIDI file: " + midiFile.getFullPathName());
+
+        file.convertTimestampTicksToSeconds();
+
+        for (int track = 0; track < file.getNumTracks(); ++track)
+            sequence.addSequence (*file.getTrack (track), 0.0);
+
+        sequence.updateMatchedPairs();
+        return juce::Result::ok();
+    }
+
+    OfflineRenderSettings settings;
+};
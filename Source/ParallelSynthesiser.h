@@ -0,0 +1,394 @@
+/*
+  ==============================================================================
+
+    ParallelSynthesiser.h
+
+    A juce::Synthesiser that hands out voices from a VoicePool and can spread
+    the playing ones across a pool of worker threads. MIDI handling is
+    untouched: the base class still splits the block at each event and calls
+    renderVoices() for the pieces in between, and only that call is shared
+    out.
+
+    Each worker mixes the voices it renders into its own buffer, and the
+    audio thread adds those into the output once every voice is done, so
+    voices never write to the same memory. The audio thread renders voices
+    too, straight into the output, rather than sitting idle, and takes back
+    any voice a worker has claimed but not started by the time it runs out
+    of voices of its own, so a worker that's descheduled can only hold the
+    block up by the one voice it's in the middle of.
+
+    The audio thread keeps core 0 to itself: it pins itself there the first
+    time it shares a block, and the workers take cores 1, 2 and so on. Thread
+    affinity masks are 32 bits wide, so only the first 32 cores are used.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "VoicePool.h"
+#include "RealtimeSafetyChecker.h"
+
+#if JUCE_INTEL
+ #include <emmintrin.h>
+#endif
+
+//==============================================================================
+class ParallelSynthesiser  : public juce::Synthesiser
+{
+public:
+    ParallelSynthesiser() = default;
+
+    ~ParallelSynthesiser() override
+    {
+        stopWorkers();
+    }
+
+    /** Replaces the voices with numVoices new ones made by createVoice. Every
+        voice must be able to play every sound the synth holds, since a free
+        voice is taken without asking. Change the voices only through this:
+        the pool falls back to the base class's allocation if their number
+        changes behind its back, but can't tell if they're swapped one for one.
+    */
+    void setVoices (int numVoices, const std::function<juce::SynthesiserVoice* (int index)>& createVoice)
+    {
+        const juce::ScopedLock sl (lock);
+        clearVoices();
+
+        for (int i = 0; i < numVoices; ++i)
+            addVoice (createVoice (i));
+
+        pool.reset (voices);
+        activeVoices.resize ((size_t) numVoices);
+        voiceStates.reset (new std::atomic<juce::uint32>[(size_t) numVoices]());
+    }
+
+    /** Starts numThreads workers in addition to the audio thread, replacing
+        any already running. Zero renders every voice on the audio thread.
+        There's at most one worker for each core but the audio thread's, and
+        no more than 31. Like addVoice(), this waits for the block being
+        rendered to finish.
+    */
+    void setNumRenderThreads (int numThreads)
+    {
+        const juce::ScopedLock sl (lock);
+        stopWorkers();
+
+        // a worker sharing a core with another, or with the audio thread,
+        // only adds a context switch to the block
+        auto numCores = juce::jmin (juce::SystemStats::getNumCpus(), maxAffinityCores);
+        numThreads = juce::jmin (numThreads, numCores - 1);
+
+        for (int i = 0; i < numThreads; ++i)
+        {
+            auto* worker = workers.add (new Worker (*this, i));
+            worker->buffer.setSize (maxChannels, maximumBlockSize);
+            worker->setAffinityMask ((juce::uint32) 1 << (i + 1));
+
+           #if JUCE_VERSION >= 0x70003
+            worker->startRealtimeThread (juce::Thread::RealtimeOptions{});
+           #else
+            worker->startThread (juce::Thread::realtimeAudioPriority);
+           #endif
+        }
+    }
+
+    int getNumRenderThreads() const noexcept        { return workers.size(); }
+
+    /** Audio thread: the number of voices playing a note. */
+    int getNumPlayingVoices() const noexcept
+    {
+        if (pool.isFor (voices))
+            return pool.getNumPlayingVoices();
+
+        int numPlaying = 0;
+
+        for (auto* voice : voices)
+            if (voice->isVoiceActive())
+                ++numPlaying;
+
+        return numPlaying;
+    }
+
+    /** Audio thread, once a block has been rendered: ends the notes that have
+        stayed below threshold for holdSamples, as VoicePool::cullInaudibleVoices()
+        does. Returns how many were ended.
+    */
+    int cullInaudibleVoices (float threshold, int numSamples, int holdSamples) noexcept
+    {
+        return pool.isFor (voices) ? pool.cullInaudibleVoices (threshold, numSamples, holdSamples) : 0;
+    }
+
+    /** Allocates the workers' buffers. Sub-blocks longer than this are
+        rendered on the audio thread alone.
+    */
+    void setMaximumBlockSize (int numSamples)
+    {
+        const juce::ScopedLock sl (lock);
+        maximumBlockSize = numSamples;
+
+        for (auto* worker : workers)
+            worker->buffer.setSize (maxChannels, maximumBlockSize);
+    }
+
+protected:
+    juce::SynthesiserVoice* findFreeVoice (juce::SynthesiserSound* sound, int midiChannel, int midiNoteNumber,
+                                           bool stealIfNoneAvailable) const override
+    {
+        if (! pool.isFor (voices))
+            return juce::Synthesiser::findFreeVoice (sound, midiChannel, midiNoteNumber, stealIfNoneAvailable);
+
+        if (auto* voice = pool.takeFreeVoice())
+            return voice;
+
+        return stealIfNoneAvailable ? pool.findVoiceToSteal() : nullptr;
+    }
+
+    void renderVoices (juce::AudioBuffer<float>& outputAudio, int startSample, int numSamples) override
+    {
+        if (! pool.isFor (voices))
+        {
+            juce::Synthesiser::renderVoices (outputAudio, startSample, numSamples);
+            return;
+        }
+
+        renderPlayingVoices (outputAudio, startSample, numSamples);
+        pool.collectFinishedVoices();
+    }
+
+    using juce::Synthesiser::renderVoices;
+
+private:
+    void renderPlayingVoices (juce::AudioBuffer<float>& outputAudio, int startSample, int numSamples)
+    {
+        auto numActive = pool.getNumPlayingVoices();
+
+        // waking the workers costs more than a handful of voices take to render
+        if (workers.isEmpty() || numActive < minimumVoicesToShare || numSamples > maximumBlockSize
+             || outputAudio.getNumChannels() > maxChannels)
+        {
+            for (int i = 0; i < numActive; ++i)
+                pool.getPlayingVoice (i)->renderNextBlock (outputAudio, startSample, numSamples);
+
+            return;
+        }
+
+        // the host can move rendering to a different thread, so check each time
+        auto thisThread = juce::Thread::getCurrentThreadId();
+
+        if (thisThread != pinnedAudioThread)
+        {
+            juce::Thread::setCurrentThreadAffinityMask (1);
+            pinnedAudioThread = thisThread;
+        }
+
+        auto generation = ++currentGeneration;
+
+        for (int i = 0; i < numActive; ++i)
+        {
+            activeVoices[(size_t) i] = pool.getPlayingVoice (i);
+            voiceStates[(size_t) i].store (pending (generation), std::memory_order_relaxed);
+        }
+
+        job.numChannels = outputAudio.getNumChannels();
+        job.numSamples = numSamples;
+        finished.store (0, std::memory_order_relaxed);
+
+        // everything above is published by this store
+        claims.store (pack (generation, numActive, 0), std::memory_order_release);
+
+        for (auto* worker : workers)
+            worker->wake.signal();
+
+        auto renderHere = [&] (int index)
+        {
+            activeVoices[(size_t) index]->renderNextBlock (outputAudio, startSample, numSamples);
+            finished.fetch_add (1, std::memory_order_release);
+        };
+
+        int index;
+
+        while ((index = claimVoice (generation)) >= 0)
+            if (startVoice (index, generation))
+                renderHere (index);
+
+        // a worker that's just claimed a voice starts it straight away, so
+        // give the workers a moment before taking back any they haven't
+        for (int spin = 0; spin < spinsBeforeHelping && finished.load (std::memory_order_acquire) < numActive; ++spin)
+            pause();
+
+        for (int i = 0; i < numActive; ++i)
+            if (startVoice (i, generation))
+                renderHere (i);
+
+        // what's left is being rendered on another core, and can't be taken
+        // over halfway through, so this is usually short; if the worker has
+        // been descheduled, stop spinning and let it have a core back
+        for (int spin = 0; finished.load (std::memory_order_acquire) < numActive; ++spin)
+        {
+            if (spin < spinsBeforeYielding)
+                pause();
+            else
+                juce::Thread::yield();
+        }
+
+        for (auto* worker : workers)
+            if (worker->usedGeneration.load (std::memory_order_relaxed) == generation)
+                for (int channel = 0; channel < job.numChannels; ++channel)
+                    juce::FloatVectorOperations::add (outputAudio.getWritePointer (channel, startSample),
+                                                      worker->buffer.getReadPointer (channel), numSamples);
+    }
+
+    //==============================================================================
+    struct Worker  : public juce::Thread
+    {
+        Worker (ParallelSynthesiser& s, int index)
+            : juce::Thread ("Voice renderer " + juce::String (index + 1)), owner (s) {}
+
+        ~Worker() override
+        {
+            stopThread (4000);
+        }
+
+        void run() override
+        {
+            // the device callback renders with denormals flushed, so the workers must too
+            juce::ScopedNoDenormals noDenormals;
+
+            while (! threadShouldExit())
+            {
+                wake.wait (100);
+
+                RealtimeSafety::ScopedRealtimeSection realtime;
+                owner.renderClaimedVoices (*this);
+            }
+        }
+
+        ParallelSynthesiser& owner;
+        juce::WaitableEvent wake;
+        juce::AudioBuffer<float> buffer;
+        std::atomic<juce::uint32> usedGeneration { 0 };
+    };
+
+    /** Worker thread: renders voices from the current job until none are left. */
+    void renderClaimedVoices (Worker& worker)
+    {
+        auto generation = generationOf (claims.load (std::memory_order_acquire));
+        bool cleared = false;
+
+        int index;
+
+        while ((index = claimVoice (generation)) >= 0)
+        {
+            // the audio thread may have taken the voice back in the meantime
+            if (! startVoice (index, generation))
+                continue;
+
+            // the job can't end, or change, while this worker holds one of its voices
+            juce::AudioBuffer<float> output (worker.buffer.getArrayOfWritePointers(), job.numChannels, job.numSamples);
+
+            if (! cleared)
+            {
+                output.clear();
+                worker.usedGeneration.store (generation, std::memory_order_relaxed);
+                cleared = true;
+            }
+
+            activeVoices[(size_t) index]->renderNextBlock (output, 0, job.numSamples);
+            finished.fetch_add (1, std::memory_order_release);
+        }
+    }
+
+    /** Takes the index of the next unclaimed voice of the given job, or
+        returns -1 if they've all been claimed or the job is over.
+    */
+    int claimVoice (juce::uint32 generation) noexcept
+    {
+        auto current = claims.load (std::memory_order_acquire);
+
+        for (;;)
+        {
+            if (generationOf (current) != generation || indexOf (current) >= countOf (current))
+                return -1;
+
+            if (claims.compare_exchange_weak (current, current + 1, std::memory_order_acq_rel))
+                return indexOf (current);
+        }
+    }
+
+    /** Takes the right to render a voice of the given job. Only one thread
+        succeeds for each voice, and none does once the job is over.
+    */
+    bool startVoice (int index, juce::uint32 generation) noexcept
+    {
+        auto expected = pending (generation);
+        return voiceStates[(size_t) index].compare_exchange_strong (expected, expected + 1, std::memory_order_acq_rel);
+    }
+
+    /** Tells the core this is a spin-wait, so it doesn't starve a hyperthread
+        sibling or flood the memory bus while it polls.
+    */
+    static void pause() noexcept
+    {
+       #if JUCE_INTEL
+        _mm_pause();
+       #elif JUCE_ARM && JUCE_MSVC
+        __yield();
+       #elif JUCE_ARM
+        __asm__ __volatile__ ("yield");
+       #endif
+    }
+
+    /** A voice's state is its job's generation times two, plus one once it's started. */
+    static juce::uint32 pending (juce::uint32 generation) noexcept      { return generation << 1; }
+
+    void stopWorkers()
+    {
+        for (auto* worker : workers)
+        {
+            worker->signalThreadShouldExit();
+            worker->wake.signal();
+        }
+
+        workers.clear();    // each worker's destructor waits for it to stop
+    }
+
+    // the job's generation, number of voices and next unclaimed voice share
+    // one atomic, so a claim can't land in a job other than the one it read
+    static juce::uint64 pack (juce::uint32 generation, int count, int index) noexcept
+    {
+        return ((juce::uint64) generation << 32) | ((juce::uint64) count << 16) | (juce::uint64) index;
+    }
+
+    static juce::uint32 generationOf (juce::uint64 packed) noexcept   { return (juce::uint32) (packed >> 32); }
+    static int countOf (juce::uint64 packed) noexcept                 { return (int) ((packed >> 16) & 0xffff); }
+    static int indexOf (juce::uint64 packed) noexcept                 { return (int) (packed & 0xffff); }
+
+    static constexpr int maxChannels = 2;
+    static constexpr int minimumVoicesToShare = 8;
+    static constexpr int spinsBeforeHelping = 2000;
+    static constexpr int spinsBeforeYielding = 20000;
+    static constexpr int maxAffinityCores = 32;
+
+    struct Job
+    {
+        int numChannels = 0, numSamples = 0;
+    };
+
+    mutable VoicePool pool;     // findFreeVoice() is const, but taking a voice changes the pool
+    juce::OwnedArray<Worker> workers;
+    int maximumBlockSize = 0;
+    std::vector<juce::SynthesiserVoice*> activeVoices;
+    std::unique_ptr<std::atomic<juce::uint32>[]> voiceStates;
+    Job job;
+    juce::uint32 currentGeneration = 0;     // audio thread only
+
+    // the base class takes its lock every block, but the message thread only
+    // does when the voices or sounds change, so it isn't a real-time violation
+    RealtimeSafety::ScopedPermittedLock permittedLock { lock };
+    juce::Thread::ThreadID pinnedAudioThread = nullptr;     // audio thread only
+    std::atomic<juce::uint64> claims { 0 };
+    std::atomic<int> finished { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE (ParallelSynthesiser)
+};
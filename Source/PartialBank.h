@@ -0,0 +1,145 @@
+/*
+  ==============================================================================
+
+    PartialBank.h
+
+    The oscillator bank behind the additive piano: up to 64 decaying sine
+    partials, stored as separate arrays of phases, increments, amplitudes
+    and decay rates rather than an array of partial objects.
+
+    Each partial is rendered a chunk at a time, like SineOscillator: the
+    phase is kept in cycles in double precision and wrapped after every
+    chunk, the samples within it come from SineOscillator::fastSine(), and
+    the exponential decay is a straight line from the chunk's first gain to
+    its last. The inner loop has no branches and no dependency between
+    samples, so it vectorises, and a partial costs the same whatever its
+    frequency. Partials that have died away are dropped from the bank.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "SineOscillator.h"
+
+//==============================================================================
+class PartialBank
+{
+public:
+    static constexpr int maxPartials = 64;
+
+    /** Partials whose amplitude falls below this, about -100 dB, are dropped. */
+    static constexpr float silenceAmplitude = 1.0e-5f;
+
+    void clear() noexcept                       { numPartials = 0; }
+
+    /** Adds a partial at zero phase. decayPerSample is what its amplitude is
+        multiplied by every sample. Does nothing if the bank is full.
+    */
+    void addPartial (double cyclesPerSample, float amplitude, float decayPerSample) noexcept
+    {
+        if (numPartials == maxPartials)
+            return;
+
+        auto i = (size_t) numPartials++;
+        phases[i] = 0.0;
+        increments[i] = cyclesPerSample;
+        amplitudes[i] = amplitude;
+        setDecay (i, decayPerSample);
+    }
+
+    /** Multiplies every partial's amplitude by gain. */
+    void applyGain (float gain) noexcept
+    {
+        for (int i = 0; i < numPartials; ++i)
+            amplitudes[(size_t) i] *= gain;
+    }
+
+    /** Makes every partial decay at least as fast as decayPerSample, as the
+        dampers do when a piano key is let go.
+    */
+    void dampen (float decayPerSample) noexcept
+    {
+        for (int i = 0; i < numPartials; ++i)
+            if (decays[(size_t) i] > decayPerSample)
+                setDecay ((size_t) i, decayPerSample);
+    }
+
+    bool isActive() const noexcept              { return numPartials > 0; }
+    int getNumPartials() const noexcept         { return numPartials; }
+
+    /** The sum of the partials' amplitudes, which no sample can exceed. */
+    float getTotalAmplitude() const noexcept
+    {
+        auto total = 0.0f;
+
+        for (int i = 0; i < numPartials; ++i)
+            total += amplitudes[(size_t) i];
+
+        return total;
+    }
+
+    /** Adds numSamples of every partial into dest and advances them. */
+    void render (float* dest, int numSamples) noexcept
+    {
+        while (numSamples > 0 && numPartials > 0)
+        {
+            auto numThisTime = numSamples < chunkSize ? numSamples : chunkSize;
+
+            for (int i = 0; i < numPartials; ++i)
+                renderPartialChunk ((size_t) i, dest, numThisTime);
+
+            dropSilentPartials();
+
+            dest += numThisTime;
+            numSamples -= numThisTime;
+        }
+    }
+
+private:
+    static constexpr int chunkSize = SineOscillator::chunkSize;
+
+    void setDecay (size_t i, float decayPerSample) noexcept
+    {
+        decays[i] = decayPerSample;
+        chunkDecays[i] = std::pow (decayPerSample, (float) chunkSize);
+    }
+
+    void renderPartialChunk (size_t i, float* dest, int numSamples) noexcept
+    {
+        const auto startPhase = (float) phases[i];
+        const auto delta = (float) increments[i];
+        const auto startGain = amplitudes[i];
+        const auto endGain = startGain * (numSamples == chunkSize ? chunkDecays[i]
+                                                                  : std::pow (decays[i], (float) numSamples));
+        const auto gainStep = (endGain - startGain) / (float) numSamples;
+
+        for (int j = 0; j < numSamples; ++j)
+            dest[j] += (startGain + gainStep * (float) j) * SineOscillator::fastSine (startPhase + delta * (float) j);
+
+        phases[i] += increments[i] * numSamples;
+        phases[i] -= std::floor (phases[i]);
+        amplitudes[i] = endGain;
+    }
+
+    /** Moves the last partial into the place of each one that has died away. */
+    void dropSilentPartials() noexcept
+    {
+        for (int i = numPartials; --i >= 0;)
+        {
+            if (amplitudes[(size_t) i] >= silenceAmplitude)
+                continue;
+
+            auto last = (size_t) --numPartials;
+            phases[(size_t) i] = phases[last];
+            increments[(size_t) i] = increments[last];
+            amplitudes[(size_t) i] = amplitudes[last];
+            decays[(size_t) i] = decays[last];
+            chunkDecays[(size_t) i] = chunkDecays[last];
+        }
+    }
+
+    std::array<double, maxPartials> phases {}, increments {};
+    std::array<float, maxPartials> amplitudes {}, decays {}, chunkDecays {};
+    int numPartials = 0;
+};
@@ -0,0 +1,16 @@
+/*
+  ==============================================================================
+
+    This file contains the entry point for the plugin and standalone builds.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "AdaptiveTuningProcessor.h"
+
+//==============================================================================
+juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
+{
+    return new AdaptiveTuningProcessor();
+}
@@ -0,0 +1,486 @@
+/*
+  ==============================================================================
+
+    RealtimeSafetyChecker.cpp
+
+    The hooks behind RealtimeSafetyChecker.h. Each hook checks a thread-local
+    depth, so outside a real-time section it costs one load and a branch
+    before calling the real function.
+
+    A violation is written into a fixed ring of records without allocating
+    or locking, so recording one doesn't cause another, and a background
+    thread prints each distinct stack the first time it's seen.
+
+  ==============================================================================
+*/
+
+#include "RealtimeSafetyChecker.h"
+
+#if ADAPTIVE_TUNING_REALTIME_CHECKS
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined (__linux__) || defined (__APPLE__)
+ #define REALTIME_CHECKS_POSIX 1
+ #include <cstdarg>
+ #include <cxxabi.h>
+ #include <dlfcn.h>
+ #include <execinfo.h>
+ #include <fcntl.h>
+ #include <poll.h>
+ #include <pthread.h>
+ #include <semaphore.h>
+ #include <sys/select.h>
+ #include <time.h>
+ #include <unistd.h>
+#else
+ #define REALTIME_CHECKS_POSIX 0
+#endif
+
+#if defined (__GLIBC__)
+ #define REALTIME_CHECKS_HOOK_MALLOC 1
+ extern "C" void* __libc_malloc (size_t);
+ extern "C" void* __libc_calloc (size_t, size_t);
+ extern "C" void* __libc_realloc (void*, size_t);
+ extern "C" void* __libc_memalign (size_t, size_t);
+ extern "C" void __libc_free (void*);
+#else
+ #define REALTIME_CHECKS_HOOK_MALLOC 0
+#endif
+
+using RealtimeSafety::Violation;
+
+namespace
+{
+    constexpr int maxStackFrames = 32;
+    constexpr int numRecords = 256;
+
+    struct Record
+    {
+        std::atomic<int> state { empty };
+        Violation violation;
+        const char* function;
+        long long sequence, block;
+        double microsecondsIntoBlock;
+        int numFrames;
+        void* frames[maxStackFrames];
+
+        enum { empty, writing, ready };
+    };
+
+    Record records[numRecords];
+    std::atomic<long long> nextSequence { 0 }, numDropped { 0 };
+    std::atomic<long long> currentBlock { 0 };
+    std::atomic<long long> blockStartNanos { 0 };
+
+    thread_local int realtimeDepth = 0;
+    thread_local bool insideHook = false;
+
+    /** A lock real-time sections may take: the memory of the object holding
+        the mutex, e.g. a juce::CriticalSection.
+    */
+    struct PermittedLock
+    {
+        std::atomic<const char*> begin { nullptr };
+        std::atomic<size_t> size { 0 };
+    };
+
+    constexpr int maxPermittedLocks = 16;
+    PermittedLock permittedLocks[maxPermittedLocks];
+
+    bool isPermitted (const void* mutex) noexcept
+    {
+        auto* address = static_cast<const char*> (mutex);
+
+        for (auto& permitted : permittedLocks)
+        {
+            auto* begin = permitted.begin.load (std::memory_order_acquire);
+
+            if (begin != nullptr && address >= begin && address < begin + permitted.size.load (std::memory_order_relaxed))
+                return true;
+        }
+
+        return false;
+    }
+
+    long long nanosecondsNow() noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /** Called by every hook before it does anything else. */
+    void check (Violation violation, const char* function) noexcept
+    {
+        if (realtimeDepth == 0 || insideHook)
+            return;
+
+        // anything the recording itself calls is ignored
+        insideHook = true;
+
+        auto sequence = nextSequence.fetch_add (1, std::memory_order_relaxed);
+        auto& record = records[sequence % numRecords];
+        auto expected = (int) Record::empty;
+
+        if (record.state.compare_exchange_strong (expected, Record::writing, std::memory_order_acquire))
+        {
+            record.violation = violation;
+            record.function = function;
+            record.sequence = sequence;
+            record.block = currentBlock.load (std::memory_order_relaxed);
+            record.microsecondsIntoBlock = (double) (nanosecondsNow() - blockStartNanos.load (std::memory_order_relaxed)) * 1.0e-3;
+           #if REALTIME_CHECKS_POSIX
+            record.numFrames = backtrace (record.frames, maxStackFrames);
+           #else
+            record.numFrames = 0;
+           #endif
+            record.state.store (Record::ready, std::memory_order_release);
+        }
+        else
+        {
+            // the reporter has fallen a whole ring behind
+            numDropped.fetch_add (1, std::memory_order_relaxed);
+        }
+
+        insideHook = false;
+    }
+
+    //==============================================================================
+    const char* getDescription (Violation violation)
+    {
+        switch (violation)
+        {
+            case Violation::allocation:     return "allocation";
+            case Violation::deallocation:   return "deallocation";
+            case Violation::lock:           return "lock";
+            case Violation::blockingCall:   return "blocking call";
+            default:                        return "violation";
+        }
+    }
+
+    void printFrame (void* address)
+    {
+       #if REALTIME_CHECKS_POSIX
+        Dl_info info;
+
+        if (dladdr (address, &info) != 0 && info.dli_sname != nullptr)
+        {
+            int status = 0;
+            auto* demangled = abi::__cxa_demangle (info.dli_sname, nullptr, nullptr, &status);
+            std::fprintf (stderr, "    %p  %s\n", address, status == 0 ? demangled : info.dli_sname);
+            std::free (demangled);
+            return;
+        }
+       #endif
+
+        std::fprintf (stderr, "    %p\n", address);
+    }
+
+    /** Prints each distinct violation the first time it's seen, and a count of
+        them all when the program exits.
+    */
+    class Reporter
+    {
+    public:
+        Reporter()
+        {
+           #if REALTIME_CHECKS_POSIX
+            // the first backtrace() can allocate while it loads the unwinder
+            void* warmUp[1];
+            backtrace (warmUp, 1);
+           #endif
+
+            thread = std::thread ([this] { run(); });
+        }
+
+        ~Reporter()
+        {
+            shouldExit = true;
+            thread.join();
+            drain();
+
+            auto total = nextSequence.load();
+
+            if (total > 0)
+                std::fprintf (stderr, "Real-time safety: %lld violations from %d places, %lld not recorded\n",
+                              total, (int) seen.size(), numDropped.load());
+        }
+
+    private:
+        void run()
+        {
+            while (! shouldExit)
+            {
+                drain();
+                std::this_thread::sleep_for (std::chrono::milliseconds (100));
+            }
+        }
+
+        void drain()
+        {
+            pending.clear();
+
+            for (auto& record : records)
+                if (record.state.load (std::memory_order_acquire) == Record::ready)
+                    pending.push_back (&record);
+
+            std::sort (pending.begin(), pending.end(), [] (const Record* a, const Record* b) { return a->sequence < b->sequence; });
+
+            for (auto* record : pending)
+            {
+                if (seen[hashOf (*record)]++ == 0)
+                {
+                    std::fprintf (stderr, "Real-time safety: %s in %s, audio block %lld, %.1f us into the block\n",
+                                  getDescription (record->violation), record->function, record->block, record->microsecondsIntoBlock);
+
+                    // the first two frames are check() and the hook itself
+                    for (int i = 2; i < record->numFrames; ++i)
+                        printFrame (record->frames[i]);
+                }
+
+                record->state.store (Record::empty, std::memory_order_release);
+            }
+
+            std::fflush (stderr);
+        }
+
+        static size_t hashOf (const Record& record)
+        {
+            auto hash = std::hash<const void*>() (record.function);
+
+            for (int i = 0; i < record.numFrames; ++i)
+                hash = hash * 31 + std::hash<void*>() (record.frames[i]);
+
+            return hash;
+        }
+
+        std::thread thread;
+        std::atomic<bool> shouldExit { false };
+        std::vector<Record*> pending;
+        std::unordered_map<size_t, long long> seen;
+    };
+
+    Reporter reporter;
+}
+
+//==============================================================================
+namespace RealtimeSafety
+{
+    void enterRealtimeSection (bool startsBlock) noexcept
+    {
+        if (startsBlock && realtimeDepth == 0)
+        {
+            currentBlock.fetch_add (1, std::memory_order_relaxed);
+            blockStartNanos.store (nanosecondsNow(), std::memory_order_relaxed);
+        }
+
+        ++realtimeDepth;
+    }
+
+    void exitRealtimeSection() noexcept
+    {
+        --realtimeDepth;
+    }
+
+    long long getNumViolations() noexcept
+    {
+        return nextSequence.load (std::memory_order_relaxed);
+    }
+
+    void permitLock (const void* lock, size_t size) noexcept
+    {
+        for (auto& permitted : permittedLocks)
+        {
+            const char* expected = nullptr;
+
+            if (permitted.begin.load (std::memory_order_relaxed) == nullptr)
+            {
+                permitted.size.store (size, std::memory_order_relaxed);
+
+                if (permitted.begin.compare_exchange_strong (expected, static_cast<const char*> (lock), std::memory_order_release))
+                    return;
+            }
+        }
+
+        // more locks than there's room for; this one will still be reported
+        std::fprintf (stderr, "Real-time safety: too many permitted locks\n");
+    }
+
+    void forbidLock (const void* lock) noexcept
+    {
+        for (auto& permitted : permittedLocks)
+        {
+            auto* expected = static_cast<const char*> (lock);
+
+            if (permitted.begin.compare_exchange_strong (expected, nullptr, std::memory_order_release))
+                return;
+        }
+    }
+}
+
+//==============================================================================
+#if REALTIME_CHECKS_HOOK_MALLOC
+// glibc lets a program replace malloc outright; operator new ends up here too
+extern "C"
+{
+    void* malloc (size_t size)
+    {
+        check (Violation::allocation, "malloc");
+        return __libc_malloc (size);
+    }
+
+    void* calloc (size_t count, size_t size)
+    {
+        check (Violation::allocation, "calloc");
+        return __libc_calloc (count, size);
+    }
+
+    void* realloc (void* block, size_t size)
+    {
+        check (Violation::allocation, "realloc");
+        return __libc_realloc (block, size);
+    }
+
+    void* memalign (size_t alignment, size_t size)
+    {
+        check (Violation::allocation, "memalign");
+        return __libc_memalign (alignment, size);
+    }
+
+    void* aligned_alloc (size_t alignment, size_t size)
+    {
+        check (Violation::allocation, "aligned_alloc");
+        return __libc_memalign (alignment, size);
+    }
+
+    int posix_memalign (void** result, size_t alignment, size_t size)
+    {
+        check (Violation::allocation, "posix_memalign");
+        *result = __libc_memalign (alignment, size);
+        return *result != nullptr || size == 0 ? 0 : ENOMEM;
+    }
+
+    void free (void* block)
+    {
+        if (block != nullptr)
+            check (Violation::deallocation, "free");
+
+        __libc_free (block);
+    }
+}
+#else
+void* operator new (std::size_t size)
+{
+    check (Violation::allocation, "operator new");
+
+    if (auto* block = std::malloc (size != 0 ? size : 1))
+        return block;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[] (std::size_t size)                                     { return operator new (size); }
+void* operator new (std::size_t size, const std::nothrow_t&) noexcept       { check (Violation::allocation, "operator new"); return std::malloc (size != 0 ? size : 1); }
+void* operator new[] (std::size_t size, const std::nothrow_t&) noexcept     { return operator new (size, std::nothrow); }
+
+void operator delete (void* block) noexcept
+{
+    if (block != nullptr)
+        check (Violation::deallocation, "operator delete");
+
+    std::free (block);
+}
+
+void operator delete[] (void* block) noexcept                               { operator delete (block); }
+void operator delete (void* block, std::size_t) noexcept                    { operator delete (block); }
+void operator delete[] (void* block, std::size_t) noexcept                  { operator delete (block); }
+void operator delete (void* block, const std::nothrow_t&) noexcept          { operator delete (block); }
+void operator delete[] (void* block, const std::nothrow_t&) noexcept        { operator delete (block); }
+#endif
+
+//==============================================================================
+#if REALTIME_CHECKS_POSIX
+namespace
+{
+    /** Looks up the function a hook stands in for. Each hook caches it in a
+        constant-initialised atomic, which unlike a dynamically initialised
+        static has no guard that could itself take a lock.
+    */
+    template <typename Function>
+    Function getReal (std::atomic<void*>& cache, const char* name) noexcept
+    {
+        auto* real = cache.load (std::memory_order_relaxed);
+
+        if (real == nullptr)
+        {
+            real = dlsym (RTLD_NEXT, name);
+            cache.store (real, std::memory_order_relaxed);
+        }
+
+        return reinterpret_cast<Function> (real);
+    }
+}
+
+#define REALTIME_CHECKS_FORWARD(violation, returnType, name, params, args) \
+    extern "C" returnType name params \
+    { \
+        static std::atomic<void*> real { nullptr }; \
+        check (violation, #name); \
+        return getReal<returnType (*) params> (real, #name) args; \
+    }
+
+REALTIME_CHECKS_FORWARD (Violation::lock, int, pthread_rwlock_rdlock, (pthread_rwlock_t* l), (l))
+REALTIME_CHECKS_FORWARD (Violation::lock, int, pthread_rwlock_wrlock, (pthread_rwlock_t* l), (l))
+REALTIME_CHECKS_FORWARD (Violation::lock, int, pthread_cond_wait, (pthread_cond_t* c, pthread_mutex_t* m), (c, m))
+REALTIME_CHECKS_FORWARD (Violation::lock, int, pthread_cond_timedwait, (pthread_cond_t* c, pthread_mutex_t* m, const struct timespec* t), (c, m, t))
+REALTIME_CHECKS_FORWARD (Violation::lock, int, pthread_join, (pthread_t t, void** r), (t, r))
+REALTIME_CHECKS_FORWARD (Violation::lock, int, sem_wait, (sem_t* s), (s))
+
+REALTIME_CHECKS_FORWARD (Violation::blockingCall, int, nanosleep, (const struct timespec* t, struct timespec* r), (t, r))
+REALTIME_CHECKS_FORWARD (Violation::blockingCall, int, usleep, (useconds_t t), (t))
+REALTIME_CHECKS_FORWARD (Violation::blockingCall, unsigned int, sleep, (unsigned int t), (t))
+REALTIME_CHECKS_FORWARD (Violation::blockingCall, ssize_t, read, (int f, void* b, size_t n), (f, b, n))
+REALTIME_CHECKS_FORWARD (Violation::blockingCall, ssize_t, write, (int f, const void* b, size_t n), (f, b, n))
+REALTIME_CHECKS_FORWARD (Violation::blockingCall, int, close, (int f), (f))
+REALTIME_CHECKS_FORWARD (Violation::blockingCall, int, fsync, (int f), (f))
+REALTIME_CHECKS_FORWARD (Violation::blockingCall, int, poll, (struct pollfd* p, nfds_t n, int t), (p, n, t))
+REALTIME_CHECKS_FORWARD (Violation::blockingCall, int, select, (int n, fd_set* r, fd_set* w, fd_set* e, struct timeval* t), (n, r, w, e, t))
+
+#undef REALTIME_CHECKS_FORWARD
+
+// pthread_mutex_lock() skips the permitted locks, so like open() below it's written out
+extern "C" int pthread_mutex_lock (pthread_mutex_t* m)
+{
+    static std::atomic<void*> real { nullptr };
+
+    if (realtimeDepth > 0 && ! isPermitted (m))
+        check (Violation::lock, "pthread_mutex_lock");
+
+    return getReal<int (*) (pthread_mutex_t*)> (real, "pthread_mutex_lock") (m);
+}
+
+// open() is variadic, so it can't go through the macro
+extern "C" int open (const char* path, int flags, ...)
+{
+    static std::atomic<void*> real { nullptr };
+    check (Violation::blockingCall, "open");
+
+    va_list args;
+    va_start (args, flags);
+    auto mode = (flags & O_CREAT) != 0 ? va_arg (args, int) : 0;
+    va_end (args);
+
+    return getReal<int (*) (const char*, int, ...)> (real, "open") (path, flags, mode);
+}
+#endif
+
+#endif
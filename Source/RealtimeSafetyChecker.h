@@ -0,0 +1,108 @@
+/*
+  ==============================================================================
+
+    RealtimeSafetyChecker.h
+
+    A checking build mode for the audio thread. Build with
+    ADAPTIVE_TUNING_REALTIME_CHECKS=1 and every heap allocation, lock and
+    blocking system call made inside a real-time section is recorded, with
+    its stack and the audio block it happened in, then printed to stderr by
+    a background thread. Link with -rdynamic to get function names.
+
+    The hooks live in RealtimeSafetyChecker.cpp. With the checks off (the
+    default) the scoped sections below are empty and compile away.
+
+    Allocations are caught through malloc and friends on glibc and through
+    operator new elsewhere. Locks and blocking calls are caught on Linux and
+    macOS, for calls made from code compiled into the app, JUCE included.
+
+    Some JUCE classes take a lock of their own every block that nothing else
+    holds while audio is running, like juce::Synthesiser's. A
+    ScopedPermittedLock stops a lock like that being reported, so the
+    report only shows what needs fixing.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cstddef>
+
+#ifndef ADAPTIVE_TUNING_REALTIME_CHECKS
+ #define ADAPTIVE_TUNING_REALTIME_CHECKS 0
+#endif
+
+//==============================================================================
+namespace RealtimeSafety
+{
+    enum class Violation
+    {
+        allocation,
+        deallocation,
+        lock,
+        blockingCall
+    };
+
+   #if ADAPTIVE_TUNING_REALTIME_CHECKS
+    void enterRealtimeSection (bool startsBlock) noexcept;
+    void exitRealtimeSection() noexcept;
+
+    /** The number of violations recorded so far, reported or not. */
+    long long getNumViolations() noexcept;
+
+    /** Taking a mutex that lies within these size bytes is no longer a
+        violation. At most 16 locks can be permitted at once.
+    */
+    void permitLock (const void* lock, size_t size) noexcept;
+    void forbidLock (const void* lock) noexcept;
+   #else
+    inline void enterRealtimeSection (bool) noexcept    {}
+    inline void exitRealtimeSection() noexcept          {}
+    inline long long getNumViolations() noexcept        { return 0; }
+    inline void permitLock (const void*, size_t) noexcept   {}
+    inline void forbidLock (const void*) noexcept           {}
+   #endif
+
+    /** Checks everything the calling thread does while this exists, e.g. a
+        worker rendering voices for the audio thread.
+    */
+    struct ScopedRealtimeSection
+    {
+        ScopedRealtimeSection() noexcept                { enterRealtimeSection (false); }
+        ~ScopedRealtimeSection() noexcept               { exitRealtimeSection(); }
+
+        ScopedRealtimeSection (const ScopedRealtimeSection&) = delete;
+        ScopedRealtimeSection& operator= (const ScopedRealtimeSection&) = delete;
+    };
+
+    /** Lets real-time sections take a lock, e.g. a juce::CriticalSection,
+        without it being reported, for as long as this exists. Only for
+        locks that nothing else takes while audio is running.
+    */
+    struct ScopedPermittedLock
+    {
+        template <typename LockType>
+        explicit ScopedPermittedLock (const LockType& lockToPermit) noexcept
+            : lock (&lockToPermit)                      { permitLock (lock, sizeof (LockType)); }
+
+        ~ScopedPermittedLock() noexcept                 { forbidLock (lock); }
+
+        ScopedPermittedLock (const ScopedPermittedLock&) = delete;
+        ScopedPermittedLock& operator= (const ScopedPermittedLock&) = delete;
+
+        const void* lock;
+    };
+
+    /** A real-time section that also starts a new audio block, unless it's
+        nested in another section. Violations are reported with the number of
+        the block and how far into it they happened.
+    */
+    struct ScopedAudioBlock
+    {
+        ScopedAudioBlock() noexcept                     { enterRealtimeSection (true); }
+        ~ScopedAudioBlock() noexcept                    { exitRealtimeSection(); }
+
+        ScopedAudioBlock (const ScopedAudioBlock&) = delete;
+        ScopedAudioBlock& operator= (const ScopedAudioBlock&) = delete;
+    };
+}
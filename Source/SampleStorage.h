@@ -0,0 +1,177 @@
+/*
+  ==============================================================================
+
+    SampleStorage.h
+
+    Sample data kept in memory as 32-bit float, 16-bit integer or 16-bit
+    half float. The 16-bit forms halve the memory, and the cache footprint,
+    of a loaded instrument; the voice converts them back to float as it
+    reads them.
+
+    The conversions have no branches, so a loop converting a run of samples
+    is vectorised by the compiler like the sine oscillator's polynomial.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+namespace SampleStorage
+{
+    enum class Format
+    {
+        float32,    // exactly as decoded
+        int16,      // about 96 dB of dynamic range; anything beyond full scale is clipped
+        half        // an 11-bit mantissa, about 66 dB of signal to noise at any level
+    };
+
+    inline juce::String getName (Format format)
+    {
+        switch (format)
+        {
+            case Format::int16:     return "int16";
+            case Format::half:      return "half";
+            case Format::float32:
+            default:                return "float32";
+        }
+    }
+
+    /** Parses a name returned by getName(). Returns false if it isn't one. */
+    inline bool parseName (const juce::String& name, Format& result)
+    {
+        for (auto format : { Format::float32, Format::int16, Format::half })
+        {
+            if (name == getName (format))
+            {
+                result = format;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    //==============================================================================
+    /** An IEEE 754 binary16 value. */
+    struct Half
+    {
+        juce::uint16 bits;
+    };
+
+    inline juce::uint32 floatToBits (float f) noexcept        { juce::uint32 u; std::memcpy (&u, &f, sizeof (u)); return u; }
+    inline float bitsToFloat (juce::uint32 u) noexcept        { float f; std::memcpy (&f, &u, sizeof (f)); return f; }
+
+    //==============================================================================
+    inline float toFloat (float value) noexcept               { return value; }
+    inline float toFloat (juce::int16 value) noexcept         { return (float) value * (1.0f / 32768.0f); }
+
+    inline float toFloat (Half value) noexcept
+    {
+        // shift the half into the top of a float's bits, then rescale the
+        // exponent; subnormal halves are rebuilt from a magic number instead
+        auto w = (juce::uint32) value.bits << 16;
+        auto sign = w & 0x80000000u;
+        auto twoW = w + w;
+
+        auto normalised = bitsToFloat ((twoW >> 4) + (0xe0u << 23)) * 0x1.0p-112f;
+        auto subnormal = bitsToFloat ((twoW >> 17) | (126u << 23)) - 0.5f;
+
+        // a mask rather than a ternary, which GCC would turn into a branch
+        auto subnormalMask = 0u - (juce::uint32) (twoW < (1u << 27));
+        return bitsToFloat (sign | (floatToBits (subnormal) & subnormalMask) | (floatToBits (normalised) & ~subnormalMask));
+    }
+
+    inline void fromFloat (float value, float& dest) noexcept          { dest = value; }
+
+    inline void fromFloat (float value, juce::int16& dest) noexcept
+    {
+        dest = (juce::int16) juce::jlimit (-32768, 32767, juce::roundToInt (value * 32768.0f));
+    }
+
+    inline void fromFloat (float value, Half& dest) noexcept
+    {
+        // rounds to nearest even, including into and out of the subnormal range
+        auto base = (std::abs (value) * 0x1.0p+112f) * 0x1.0p-110f;
+
+        auto w = floatToBits (value);
+        auto shl1W = w + w;
+        auto sign = w & 0x80000000u;
+        auto bias = juce::jmax (shl1W & 0xff000000u, 0x71000000u);
+
+        auto bits = floatToBits (bitsToFloat ((bias >> 1) + 0x07800000u) + base);
+        auto nonSign = ((bits >> 13) & 0x00007c00u) + (bits & 0x00000fffu);
+
+        dest.bits = (juce::uint16) ((sign >> 16) | (shl1W > 0xff000000u ? 0x7e00u : nonSign));
+    }
+
+    /** Converts a run of stored samples to float. */
+    template <typename SampleType>
+    void toFloat (const SampleType* source, float* dest, int numSamples) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] = toFloat (source[i]);
+    }
+}
+
+//==============================================================================
+/** A multichannel block of samples in one of the storage formats. */
+class SampleBuffer
+{
+public:
+    SampleBuffer() = default;
+
+    /** Reallocates the buffer and fills it with silence. */
+    void setSize (SampleStorage::Format newFormat, int newNumChannels, int newNumFrames)
+    {
+        format = newFormat;
+        numChannels = newNumChannels;
+        numFrames = newNumFrames;
+        bytesPerSample = format == SampleStorage::Format::float32 ? 4 : 2;
+
+        // all three formats store silence as zero bits
+        data.calloc ((size_t) numChannels * (size_t) numFrames * (size_t) bytesPerSample);
+    }
+
+    SampleStorage::Format getFormat() const noexcept        { return format; }
+    int getNumChannels() const noexcept                     { return numChannels; }
+    int getNumFrames() const noexcept                       { return numFrames; }
+    size_t getSizeInBytes() const noexcept                  { return (size_t) numChannels * (size_t) numFrames * (size_t) bytesPerSample; }
+
+    /** SampleType must be the type that matches the format: float, int16 or Half. */
+    template <typename SampleType>
+    const SampleType* getReadPointer (int channel) const noexcept
+    {
+        jassert (sizeof (SampleType) == (size_t) bytesPerSample && juce::isPositiveAndBelow (channel, numChannels));
+        return reinterpret_cast<const SampleType*> (data.get() + (size_t) channel * (size_t) numFrames * (size_t) bytesPerSample);
+    }
+
+    /** Converts numSamples floats into the buffer's format. */
+    void write (int channel, int startFrame, const float* source, int numSamples) noexcept
+    {
+        switch (format)
+        {
+            case SampleStorage::Format::int16:   writeAs<juce::int16> (channel, startFrame, source, numSamples); break;
+            case SampleStorage::Format::half:    writeAs<SampleStorage::Half> (channel, startFrame, source, numSamples); break;
+            case SampleStorage::Format::float32:
+            default:                             writeAs<float> (channel, startFrame, source, numSamples); break;
+        }
+    }
+
+private:
+    template <typename SampleType>
+    void writeAs (int channel, int startFrame, const float* source, int numSamples) noexcept
+    {
+        jassert (startFrame >= 0 && startFrame + numSamples <= numFrames);
+        auto* dest = const_cast<SampleType*> (getReadPointer<SampleType> (channel)) + startFrame;
+
+        for (int i = 0; i < numSamples; ++i)
+            SampleStorage::fromFloat (source[i], dest[i]);
+    }
+
+    SampleStorage::Format format = SampleStorage::Format::float32;
+    int numChannels = 0, numFrames = 0, bytesPerSample = 4;
+    juce::HeapBlock<char> data;
+
+    JUCE_DECLARE_NON_COPYABLE (SampleBuffer)
+};
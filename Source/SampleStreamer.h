@@ -0,0 +1,231 @@
+/*
+  ==============================================================================
+
+    SampleStreamer.h
+
+    Streams the parts of long samples that aren't kept in memory. Each
+    sampler voice owns a SampleStream, a ring buffer that a background thread
+    keeps topped up from disk while the voice plays through it. The audio
+    thread never waits for the disk: a frame that hasn't arrived yet plays as
+    silence and is counted as an underrun.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "SamplerInstrument.h"
+
+//==============================================================================
+/** A single-reader, single-writer ring buffer of sample frames.
+
+    Frames are addressed by their absolute position in the sample. The voice
+    reads frames up to getAvailableEnd() and calls release() as it moves on;
+    the streamer fills in frames beyond the available end, up to one ring's
+    length ahead of the last released position.
+
+    Each start() begins a new generation. The generation is packed into the
+    same atomic as the available end, so a write the streamer started for a
+    previous note can never be mistaken for data belonging to the new one.
+*/
+class SampleStream
+{
+public:
+    static constexpr int ringSize = 1 << 16;
+
+    SampleStream() : ring (2, ringSize)   { ring.clear(); }
+
+    //==============================================================================
+    /** Audio thread: begins streaming a sample just past its preloaded head. */
+    void start (const SampleData& sample) noexcept
+    {
+        jassert (sample.isStreamed());
+        auto headLength = (juce::int64) sample.audio.getNumFrames();
+
+        // the source goes first, so the streamer can't pair a new fill position with an old source
+        source.store (&sample);
+        readPosition.store (headLength);
+        fill.store (pack (++generation, headLength));
+    }
+
+    /** Audio thread: stops streaming. Must be called before the voice lets go
+        of its reference to the sample.
+    */
+    void stop() noexcept
+    {
+        source.store (nullptr);
+    }
+
+    /** Audio thread: frames before this one are available to read. */
+    juce::int64 getAvailableEnd() const noexcept        { return endOf (fill.load()); }
+
+    /** Audio thread: lets the streamer reuse the space of frames before this one. */
+    void release (juce::int64 position) noexcept
+    {
+        if (position > readPosition.load())
+            readPosition.store (position);
+    }
+
+    float getSample (int channel, juce::int64 frame) const noexcept
+    {
+        return ring.getSample (channel, (int) (frame & (ringSize - 1)));
+    }
+
+    void reportUnderrun() noexcept                      { underruns.fetch_add (1, std::memory_order_relaxed); }
+    int getNumUnderruns() const noexcept                { return underruns.load (std::memory_order_relaxed); }
+
+    //==============================================================================
+    /** Streamer thread: reads up to maxFrames more of the sample into the ring.
+        Returns true if it did anything.
+    */
+    bool service (int maxFrames)
+    {
+        auto currentFill = fill.load();
+        auto* sample = source.load();
+
+        if (sample == nullptr)
+            return false;
+
+        auto end = endOf (currentFill);
+
+        // the reader pads past the end of the file with silence, which interpolation relies on
+        auto limit = juce::jmin (readPosition.load() + ringSize, sample->length + SampleData::paddingFrames);
+        auto numFrames = (int) juce::jmin ((juce::int64) maxFrames, limit - end);
+
+        if (numFrames <= 0)
+            return false;
+
+        auto ringStart = (int) (end & (ringSize - 1));
+        auto numBeforeWrap = juce::jmin (numFrames, ringSize - ringStart);
+
+        sample->streamReader->read (&ring, ringStart, numBeforeWrap, end, true, true);
+
+        if (numBeforeWrap < numFrames)
+            sample->streamReader->read (&ring, 0, numFrames - numBeforeWrap, end + numBeforeWrap, true, true);
+
+        // fails harmlessly if the voice has started another note in the meantime
+        fill.compare_exchange_strong (currentFill, pack (generationOf (currentFill), end + numFrames));
+        return true;
+    }
+
+private:
+    static constexpr int endBits = 40;
+
+    static juce::uint64 pack (juce::uint32 gen, juce::int64 end) noexcept
+    {
+        return ((juce::uint64) gen << endBits) | (juce::uint64) end;
+    }
+
+    static juce::uint32 generationOf (juce::uint64 packed) noexcept   { return (juce::uint32) (packed >> endBits); }
+    static juce::int64 endOf (juce::uint64 packed) noexcept           { return (juce::int64) (packed & ((1ull << endBits) - 1)); }
+
+    juce::AudioBuffer<float> ring;
+    std::atomic<const SampleData*> source { nullptr };
+    std::atomic<juce::int64> readPosition { 0 };
+    std::atomic<juce::uint64> fill { 0 };
+    std::atomic<int> underruns { 0 };
+    juce::uint32 generation = 0;    // audio thread only
+
+    JUCE_DECLARE_NON_COPYABLE (SampleStream)
+};
+
+//==============================================================================
+/** Owns the voices' streams and the thread that fills them.
+
+    The thread holds the instrument publisher's collection lock while it
+    reads, so an instrument can't be deleted while its file is being read
+    even if the voice playing it has just let go. It doesn't hold the lock
+    on the list of streams: it copies the list, and destroyStream() leaves
+    the stream for the thread to delete between passes, so creating and
+    destroying streams never waits for the disk.
+*/
+class SampleStreamer  : private juce::Thread
+{
+public:
+    explicit SampleStreamer (const SamplerInstrumentPublisher& publisher)
+        : juce::Thread ("Sample streamer"), instruments (publisher)
+    {
+    }
+
+    ~SampleStreamer() override
+    {
+        stopThread (4000);
+    }
+
+    /** Creates a stream for a voice. The stream lives until destroyStream()
+        is called or the streamer is deleted.
+    */
+    SampleStream* createStream()
+    {
+        const juce::ScopedLock sl (streamsLock);
+        return streams.add (new SampleStream());
+    }
+
+    /** Deletes a stream made by createStream(), once its voice is done with it. */
+    void destroyStream (SampleStream* stream)
+    {
+        const juce::ScopedLock sl (streamsLock);
+        retiredUnderruns += stream->getNumUnderruns();
+
+        // the thread may be reading into it right now, so it deletes it later
+        streams.removeObject (stream, false);
+        retiredStreams.add (stream);
+    }
+
+    /** Starts the streaming thread, if it isn't already running. */
+    void start()
+    {
+        startThread();
+    }
+
+    int getNumUnderruns() const
+    {
+        const juce::ScopedLock sl (streamsLock);
+        auto total = retiredUnderruns;
+
+        for (auto* stream : streams)
+            total += stream->getNumUnderruns();
+
+        return total;
+    }
+
+private:
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            bool didSomething = false;
+
+            {
+                const juce::ScopedLock sl (streamsLock);
+
+                // nothing from the last pass is still being read
+                retiredStreams.clear();
+
+                servicing.clearQuick();
+                servicing.addArray (streams.begin(), streams.size());
+            }
+
+            // a bounded read per stream per pass, so one fast voice can't starve the others
+            for (auto* stream : servicing)
+            {
+                const juce::ScopedLock collection (instruments.getCollectionLock());
+                didSomething = stream->service (maxFramesPerRead) || didSomething;
+            }
+
+            if (! didSomething)
+                wait (2);
+        }
+    }
+
+    static constexpr int maxFramesPerRead = 8192;
+
+    const SamplerInstrumentPublisher& instruments;
+    juce::CriticalSection streamsLock;
+    juce::OwnedArray<SampleStream> streams;
+    juce::OwnedArray<SampleStream> retiredStreams;     // destroyed, but maybe still being read
+    juce::Array<SampleStream*> servicing;               // streamer thread only
+    int retiredUnderruns = 0;
+
+    JUCE_DECLARE_NON_COPYABLE (SampleStreamer)
+};
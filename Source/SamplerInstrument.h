@@ -0,0 +1,520 @@
+/*
+  ==============================================================================
+
+    SamplerInstrument.h
+
+    The sample data played by SamplerEngine, the instruments that map it
+    across the keyboard, and the publisher that swaps instruments on the
+    audio thread without waiting on anything.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "SfzFile.h"
+#include "SampleStorage.h"
+#include "Envelope.h"
+
+//==============================================================================
+/** One sample, either decoded into memory in full or streamed from disk.
+    Immutable once it's been published.
+*/
+struct SampleData   : public juce::ReferenceCountedObject
+{
+    using Ptr = juce::ReferenceCountedObjectPtr<SampleData>;
+
+    /** How much of a streamed sample is kept in memory, so that a note can
+        start playing straight away while the streamer catches up.
+    */
+    static constexpr int streamingPreloadFrames = 1 << 16;
+
+    /** The zeroed frames after the end of a sample, enough for the widest
+        interpolation window to read past it.
+    */
+    static constexpr int paddingFrames = 32;
+
+    /** Decodes up to maxLengthSeconds of the reader's audio into the given
+        storage format. The progress callback is called with values from 0 to 1
+        as the data is read, and can return false to abandon the load, in which
+        case nullptr is returned.
+    */
+    static Ptr createFromReader (juce::AudioFormatReader& reader, double maxLengthSeconds, SampleStorage::Format format,
+                                 const std::function<bool (double)>& progressCallback = {})
+    {
+        auto length = (int) juce::jmin (reader.lengthInSamples, (juce::int64) (maxLengthSeconds * reader.sampleRate));
+        Ptr sample (new SampleData());
+        sample->sourceSampleRate = reader.sampleRate;
+        sample->length = length;
+
+        // like SamplerSound, keep some extra zeroed samples so interpolation can read past the end
+        sample->audio.setSize (format, (int) juce::jmin (2u, reader.numChannels), length + paddingFrames);
+
+        if (! sample->decode (reader, length, progressCallback))
+            return nullptr;
+
+        return sample;
+    }
+
+    /** Decodes only the first streamingPreloadFrames of the reader's audio and
+        keeps the reader, so the rest can be streamed by a SampleStreamer.
+    */
+    static Ptr createStreamed (std::unique_ptr<juce::AudioFormatReader> reader, SampleStorage::Format format,
+                               const std::function<bool (double)>& progressCallback = {})
+    {
+        auto headLength = (int) juce::jmin (reader->lengthInSamples, (juce::int64) streamingPreloadFrames);
+        Ptr sample (new SampleData());
+        sample->sourceSampleRate = reader->sampleRate;
+        sample->length = reader->lengthInSamples;
+
+        sample->audio.setSize (format, (int) juce::jmin (2u, reader->numChannels), headLength);
+
+        if (! sample->decode (*reader, headLength, progressCallback))
+            return nullptr;
+
+        sample->streamReader = std::move (reader);
+        return sample;
+    }
+
+    bool isStreamed() const noexcept        { return streamReader != nullptr; }
+
+    SampleBuffer audio;                     // the whole sample, or just its head if it's streamed
+    double sourceSampleRate = 44100.0;
+    juce::int64 length = 0;
+
+    /** Only ever read from by the SampleStreamer thread once published. */
+    std::unique_ptr<juce::AudioFormatReader> streamReader;
+
+private:
+    /** Reads the first numFrames of the reader into audio, a chunk at a time. */
+    bool decode (juce::AudioFormatReader& reader, int numFrames, const std::function<bool (double)>& progressCallback)
+    {
+        const int chunkSize = 65536;
+        juce::AudioBuffer<float> chunk (audio.getNumChannels(), juce::jmin (chunkSize, numFrames));
+
+        for (int position = 0; position < numFrames; position += chunkSize)
+        {
+            auto numThisTime = juce::jmin (chunkSize, numFrames - position);
+
+            if (! reader.read (&chunk, 0, numThisTime, position, true, true))
+                return false;
+
+            for (int channel = 0; channel < audio.getNumChannels(); ++channel)
+                audio.write (channel, position, chunk.getReadPointer (channel), numThisTime);
+
+            if (progressCallback != nullptr && ! progressCallback ((position + numThisTime) / (double) numFrames))
+                return false;
+        }
+
+        return true;
+    }
+};
+
+//==============================================================================
+/** Everything a sampler voice needs to play a note: a set of zones, each
+    mapping one sample over a key range and a velocity range.
+
+    Zones are added before the instrument is published. Each one is written
+    into a table indexed by key and MIDI velocity, so finding the zone for a
+    note is a single lookup however many zones there are.
+*/
+struct SamplerInstrument   : public juce::ReferenceCountedObject
+{
+    using Ptr = juce::ReferenceCountedObjectPtr<SamplerInstrument>;
+
+    struct Zone
+    {
+        SampleData::Ptr sample;
+        int rootNote = 60;
+        int lowNote = 0, highNote = 127;
+        int lowVelocity = 0, highVelocity = 127;
+    };
+
+    SamplerInstrument()
+    {
+        zoneLookup.fill (-1);
+    }
+
+    /** Maps a zone. Where zones overlap, the one added first wins. */
+    void addZone (const Zone& zone)
+    {
+        jassert (zone.sample != nullptr && zones.size() < std::numeric_limits<juce::int16>::max());
+        zones.add (zone);
+
+        for (int note = juce::jmax (0, zone.lowNote); note <= juce::jmin (127, zone.highNote); ++note)
+            for (int velocity = juce::jmax (0, zone.lowVelocity); velocity <= juce::jmin (127, zone.highVelocity); ++velocity)
+                if (zoneLookup[(size_t) (note * 128 + velocity)] < 0)
+                    zoneLookup[(size_t) (note * 128 + velocity)] = (juce::int16) (zones.size() - 1);
+    }
+
+    /** Returns the zone to play for a note, or nullptr if the note isn't mapped. */
+    const Zone* findZone (int midiNoteNumber, float velocity) const noexcept
+    {
+        jassert (juce::isPositiveAndBelow (midiNoteNumber, 128));
+        auto midiVelocity = juce::jlimit (0, 127, juce::roundToInt (velocity * 127.0f));
+        auto index = zoneLookup[(size_t) (midiNoteNumber * 128 + midiVelocity)];
+
+        return index >= 0 ? &zones.getReference (index) : nullptr;
+    }
+
+    int getNumZones() const noexcept        { return zones.size(); }
+
+    juce::String name;
+    Envelope::Parameters envelope;
+
+private:
+    juce::Array<Zone> zones;
+    std::array<juce::int16, 128 * 128> zoneLookup;
+};
+
+//==============================================================================
+/** The decoded samples shared by every instrument a loader creates, keyed by
+    file. A file used by several zones, or by an instrument that's loaded
+    again, is only decoded once.
+*/
+class SamplePool
+{
+public:
+    SamplePool() = default;
+
+    /** Returns the sample for a file, decoding it with createSample if it
+        isn't in the pool yet. Samples loaded with and without streaming
+        allowed, or in different formats, are kept apart.
+    */
+    template <typename CreateFunction>
+    SampleData::Ptr getOrCreate (const juce::File& file, bool streamable, SampleStorage::Format format,
+                                 CreateFunction&& createSample)
+    {
+        const juce::ScopedLock sl (lock);
+
+        for (auto& entry : entries)
+            if (entry.file == file && entry.streamable == streamable && entry.format == format)
+                return entry.sample;
+
+        SampleData::Ptr sample (createSample());
+
+        if (sample != nullptr)
+            entries.add ({ file, streamable, format, sample });
+
+        return sample;
+    }
+
+    /** Forgets samples that no instrument uses any more. */
+    void removeUnused()
+    {
+        const juce::ScopedLock sl (lock);
+
+        for (int i = entries.size(); --i >= 0;)
+            if (entries.getReference (i).sample->getReferenceCount() == 1)
+                entries.remove (i);
+    }
+
+private:
+    struct Entry
+    {
+        juce::File file;
+        bool streamable;
+        SampleStorage::Format format;
+        SampleData::Ptr sample;
+    };
+
+    juce::CriticalSection lock;
+    juce::Array<Entry> entries;
+
+    JUCE_DECLARE_NON_COPYABLE (SamplePool)
+};
+
+//==============================================================================
+/** Hands instruments to the audio thread.
+
+    publish() can be called from any one non-audio thread at a time. The audio
+    thread calls acquire() once per block, and voices may keep a reference to
+    the instrument they're playing for as long as the note lasts. Instruments
+    are only deleted by collectGarbage(), once nothing but the publisher
+    refers to them, so the audio thread never frees memory. Other threads
+    that read sample data, like the SampleStreamer, hold the collection lock
+    while they do.
+*/
+class SamplerInstrumentPublisher
+{
+public:
+    SamplerInstrumentPublisher() = default;
+
+    void publish (SamplerInstrument::Ptr newInstrument)
+    {
+        pool.add (newInstrument);
+        current.exchange (newInstrument.get());
+        collectGarbage();
+    }
+
+    /** Audio thread only. The instrument stays valid until the next call, or
+        for as long as a voice holds a reference to it.
+    */
+    SamplerInstrument* acquire() noexcept
+    {
+        auto* instrument = current.load();
+
+        for (;;)
+        {
+            inUse.store (instrument);
+            auto* latest = current.load();
+
+            if (latest == instrument)
+                return instrument;
+
+            instrument = latest;
+        }
+    }
+
+    /** Deletes instruments that have been replaced and aren't playing any more.
+        Must be called from the same thread as publish().
+    */
+    void collectGarbage()
+    {
+        const juce::ScopedLock sl (collectionLock);
+        auto* live = current.load();
+        auto* used = inUse.load();
+
+        for (int i = pool.size(); --i >= 0;)
+        {
+            auto* instrument = pool.getObjectPointerUnchecked (i);
+
+            if (instrument != live && instrument != used && instrument->getReferenceCount() == 1)
+                pool.remove (i);
+        }
+    }
+
+    /** Held while instruments are being deleted. */
+    const juce::CriticalSection& getCollectionLock() const noexcept     { return collectionLock; }
+
+private:
+    std::atomic<SamplerInstrument*> current { nullptr };
+    std::atomic<SamplerInstrument*> inUse { nullptr };
+    juce::ReferenceCountedArray<SamplerInstrument> pool;
+    juce::CriticalSection collectionLock;
+
+    JUCE_DECLARE_NON_COPYABLE (SamplerInstrumentPublisher)
+};
+
+//==============================================================================
+/** Decodes samples on its own thread and publishes the finished instruments.
+    Progress and completion are reported on the message thread.
+
+    A file is either a single sample, which is mapped across the whole
+    keyboard with middle C as its root, or an .sfz file mapping several
+    samples over key and velocity ranges.
+*/
+class SampleLoader  : private juce::Thread,
+                      private juce::AsyncUpdater
+{
+public:
+    SampleLoader (juce::AudioFormatManager& formats, SamplerInstrumentPublisher& target)
+        : juce::Thread ("Sample loader"), formatManager (formats), publisher (target)
+    {
+    }
+
+    ~SampleLoader() override
+    {
+        cancelPendingUpdate();
+        stopThread (4000);
+    }
+
+    /** Queues a file to be loaded; a newer request replaces one that hasn't started yet. */
+    void loadAsync (const juce::File& file)
+    {
+        {
+            const juce::ScopedLock sl (lock);
+            pendingFile = file;
+        }
+
+        progress = 0.0;
+        startThread();
+        notify();
+    }
+
+    /** When enabled, background loads of samples much longer than the preload
+        only decode the head and stream the rest from disk while playing.
+    */
+    void setStreamingEnabled (bool shouldStream) noexcept     { streamingEnabled = shouldStream; }
+
+    /** Sets how samples loaded from now on are kept in memory. */
+    void setStorageFormat (SampleStorage::Format newFormat) noexcept     { storageFormat = newFormat; }
+
+    /** Decodes a file on the calling thread and publishes it. The whole file
+        is always decoded, since an offline render could outrun the streamer.
+    */
+    juce::Result loadNow (const juce::File& file)
+    {
+        auto instrument = createInstrument (file, {}, false);
+
+        if (instrument == nullptr)
+            return juce::Result::fail ("Couldn't read " + file.getFullPathName());
+
+        const juce::ScopedLock sl (publishLock);
+        publisher.publish (instrument);
+        return juce::Result::ok();
+    }
+
+    /** Called on the message thread with the fraction loaded so far. */
+    std::function<void (double)> onProgress;
+
+    /** Called on the message thread once a load has finished or failed. */
+    std::function<void (const juce::Result&)> onLoaded;
+
+private:
+    SamplerInstrument::Ptr createInstrument (const juce::File& file, const std::function<bool (double)>& progressCallback,
+                                             bool allowStreaming)
+    {
+        SamplerInstrument::Ptr instrument (new SamplerInstrument());
+        instrument->name = file.getFileNameWithoutExtension();
+
+        if (! file.hasFileExtension ("sfz"))
+        {
+            auto sample = getSample (file, allowStreaming, progressCallback);
+
+            if (sample == nullptr)
+                return nullptr;
+
+            instrument->addZone ({ sample });
+            return instrument;
+        }
+
+        SfzFile sfz;
+
+        if (SfzFile::load (file, sfz).failed())
+            return nullptr;
+
+        auto numRegions = sfz.regions.size();
+
+        for (int i = 0; i < numRegions; ++i)
+        {
+            auto& region = sfz.regions.getReference (i);
+
+            auto sample = getSample (region.sample, allowStreaming, [&] (double fraction)
+            {
+                return progressCallback == nullptr || progressCallback ((i + fraction) / numRegions);
+            });
+
+            if (sample == nullptr)
+                return nullptr;
+
+            instrument->addZone ({ sample, region.rootKey, region.lowKey, region.highKey,
+                                  region.lowVelocity, region.highVelocity });
+        }
+
+        return instrument;
+    }
+
+    SampleData::Ptr getSample (const juce::File& file, bool allowStreaming, const std::function<bool (double)>& progressCallback)
+    {
+        auto format = storageFormat.load();
+
+        return samplePool.getOrCreate (file, allowStreaming, format, [&]() -> SampleData::Ptr
+        {
+            auto reader = allowStreaming ? createStreamingReader (file)
+                                         : std::unique_ptr<juce::AudioFormatReader> (formatManager.createReaderFor (file));
+
+            if (reader == nullptr)
+                return nullptr;
+
+            if (allowStreaming && reader->lengthInSamples > 2 * SampleData::streamingPreloadFrames)
+                return SampleData::createStreamed (std::move (reader), format, progressCallback);
+
+            return SampleData::createFromReader (*reader, maximumSampleLengthSeconds, format, progressCallback);
+        });
+    }
+
+    /** Memory-maps the file if its format allows it, so streaming reads are just page faults. */
+    std::unique_ptr<juce::AudioFormatReader> createStreamingReader (const juce::File& file)
+    {
+        if (auto* format = formatManager.findFormatForFileExtension (file.getFileExtension()))
+        {
+            std::unique_ptr<juce::MemoryMappedAudioFormatReader> mapped (format->createMemoryMappedReader (file));
+
+            if (mapped != nullptr && mapped->mapEntireFile())
+                return mapped;
+        }
+
+        return std::unique_ptr<juce::AudioFormatReader> (formatManager.createReaderFor (file));
+    }
+
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            juce::File file;
+
+            {
+                const juce::ScopedLock sl (lock);
+                std::swap (file, pendingFile);
+            }
+
+            if (file == juce::File())
+            {
+                // wake up now and then to free instruments that have finished playing
+                wait (1000);
+
+                const juce::ScopedLock sl (publishLock);
+                publisher.collectGarbage();
+                samplePool.removeUnused();
+                continue;
+            }
+
+            auto instrument = createInstrument (file, [this] (double fraction)
+            {
+                progress = fraction;
+                triggerAsyncUpdate();
+                return ! threadShouldExit();
+            }, streamingEnabled);
+
+            {
+                const juce::ScopedLock sl (lock);
+                lastResult = instrument != nullptr ? juce::Result::ok()
+                                                   : juce::Result::fail ("Couldn't read " + file.getFullPathName());
+                finished = true;
+            }
+
+            if (instrument != nullptr)
+            {
+                const juce::ScopedLock sl (publishLock);
+                publisher.publish (instrument);
+            }
+
+            progress = 1.0;
+            triggerAsyncUpdate();
+        }
+    }
+
+    void handleAsyncUpdate() override
+    {
+        if (onProgress != nullptr)
+            onProgress (progress.load());
+
+        auto result = juce::Result::ok();
+        bool justFinished = false;
+
+        {
+            const juce::ScopedLock sl (lock);
+            std::swap (justFinished, finished);
+            result = lastResult;
+        }
+
+        if (justFinished && onLoaded != nullptr)
+            onLoaded (result);
+    }
+
+    static constexpr double maximumSampleLengthSeconds = 1000.0;
+
+    juce::AudioFormatManager& formatManager;
+    SamplerInstrumentPublisher& publisher;
+    SamplePool samplePool;
+    juce::CriticalSection lock, publishLock;
+    juce::File pendingFile;
+    juce::Result lastResult { juce::Result::ok() };
+    bool finished = false;
+    std::atomic<double> progress { 0.0 };
+    std::atomic<bool> streamingEnabled { true };
+    std::atomic<SampleStorage::Format> storageFormat { SampleStorage::Format::float32 };
+
+    JUCE_DECLARE_NON_COPYABLE (SampleLoader)
+};
@@ -0,0 +1,360 @@
+/*
+  ==============================================================================
+
+    ScalaTuning.h
+
+    Reads Scala scale (.scl) and keyboard mapping (.kbm) files and compiles
+    them into the same flat TuningTable the built-in limits use, so a Scala
+    tuning costs the audio thread nothing extra.
+
+    The engine tunes every note relative to a moving reference note, so only
+    the intervals of a tuning matter: a .kbm's mapping pattern is applied
+    relative to the reference, and its key range and reference frequency are
+    ignored. Unmapped keys fall back to 12-tone equal temperament.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "TuningTable.h"
+
+//==============================================================================
+struct ScalaScale
+{
+    /** Parses the text of a .scl file. */
+    static juce::Result parse (const juce::String& text, ScalaScale& result)
+    {
+        auto lines = getNonCommentLines (text);
+
+        if (lines.size() < 2)
+            return juce::Result::fail ("Missing description or note count");
+
+        result.description = lines[0].trim();
+        auto countToken = getFirstToken (lines[1]);
+        auto numNotes = countToken.getIntValue();
+
+        if (numNotes < 1 || ! countToken.containsOnly ("0123456789"))
+            return juce::Result::fail ("Invalid note count: " + countToken);
+
+        if (lines.size() < numNotes + 2)
+            return juce::Result::fail ("Expected " + juce::String (numNotes) + " notes but found "
+                                        + juce::String (lines.size() - 2));
+
+        result.ratios.clearQuick();
+        result.ratios.add (1.0);
+
+        for (int i = 0; i < numNotes; ++i)
+        {
+            auto token = getFirstToken (lines[i + 2]);
+            auto ratio = parsePitch (token);
+
+            if (! (ratio > 0.0))
+                return juce::Result::fail ("Invalid pitch: " + token);
+
+            result.ratios.add (ratio);
+        }
+
+        return juce::Result::ok();
+    }
+
+    static juce::Result load (const juce::File& file, ScalaScale& result)
+    {
+        if (! file.existsAsFile())
+            return juce::Result::fail ("Couldn't find " + file.getFullPathName());
+
+        auto parsed = parse (file.loadFileAsString(), result);
+
+        if (parsed.failed())
+            return juce::Result::fail (file.getFileName() + ": " + parsed.getErrorMessage());
+
+        return parsed;
+    }
+
+    /** The number of degrees before the scale repeats; the last pitch in the file is the period. */
+    int getNumDegrees() const noexcept                  { return ratios.size() - 1; }
+    double getPeriod() const noexcept                   { return ratios.getLast(); }
+
+    /** Returns the ratio of any degree, including ones beyond the period or below 0. */
+    double getDegreeRatio (int degree) const noexcept
+    {
+        auto numDegrees = getNumDegrees();
+        auto periods = degree >= 0 ? degree / numDegrees : -((numDegrees - 1 - degree) / numDegrees);
+        return ratios.getUnchecked (degree - periods * numDegrees) * std::pow (getPeriod(), periods);
+    }
+
+    /** Splits the text into lines, dropping the '!' comment lines. */
+    static juce::StringArray getNonCommentLines (const juce::String& text)
+    {
+        juce::StringArray lines;
+
+        for (auto& line : juce::StringArray::fromLines (text))
+            if (! line.startsWithChar ('!'))
+                lines.add (line);
+
+        return lines;
+    }
+
+    static juce::String getFirstToken (const juce::String& line)
+    {
+        return line.trim().upToFirstOccurrenceOf (" ", false, false)
+                          .upToFirstOccurrenceOf ("\t", false, false);
+    }
+
+    juce::String description;
+    juce::Array<double> ratios;   // degree 0 (always 1/1) up to and including the period
+
+private:
+    /** A pitch is in cents if it contains a '.', otherwise it's a ratio like 3/2 or 2. */
+    static double parsePitch (const juce::String& token)
+    {
+        if (token.containsChar ('.'))
+            return std::pow (2.0, token.getDoubleValue() / 1200.0);
+
+        auto numerator = token.upToFirstOccurrenceOf ("/", false, false);
+        auto denominator = token.fromFirstOccurrenceOf ("/", false, false);
+
+        if (numerator.isEmpty() || ! numerator.containsOnly ("0123456789")
+             || ! denominator.containsOnly ("0123456789"))
+            return 0.0;
+
+        return numerator.getDoubleValue() / (denominator.isEmpty() ? 1.0 : denominator.getDoubleValue());
+    }
+};
+
+//==============================================================================
+struct ScalaKeyboardMapping
+{
+    /** Parses the text of a .kbm file. */
+    static juce::Result parse (const juce::String& text, ScalaKeyboardMapping& result)
+    {
+        auto lines = ScalaScale::getNonCommentLines (text);
+        lines.trim();
+        lines.removeEmptyStrings();
+
+        if (lines.size() < 7)
+            return juce::Result::fail ("Expected 7 header values but found " + juce::String (lines.size()));
+
+        auto mapSize = lines[0].getIntValue();
+
+        if (mapSize < 0 || lines.size() < 7 + mapSize)
+            return juce::Result::fail ("Expected " + juce::String (mapSize) + " mapping entries");
+
+        result.formalOctaveDegree = lines[6].getIntValue();
+        result.keys.clearQuick();
+
+        for (int i = 0; i < mapSize; ++i)
+        {
+            auto entry = ScalaScale::getFirstToken (lines[7 + i]);
+
+            if (entry.equalsIgnoreCase ("x"))
+                result.keys.add (-1);
+            else if (entry.containsOnly ("0123456789") && entry.isNotEmpty())
+                result.keys.add (entry.getIntValue());
+            else
+                return juce::Result::fail ("Invalid mapping entry: " + entry);
+        }
+
+        if (mapSize > 0 && result.formalOctaveDegree <= 0)
+            return juce::Result::fail ("The formal octave degree must be positive");
+
+        return juce::Result::ok();
+    }
+
+    static juce::Result load (const juce::File& file, ScalaKeyboardMapping& result)
+    {
+        auto parsed = parse (file.loadFileAsString(), result);
+
+        if (parsed.failed())
+            return juce::Result::fail (file.getFileName() + ": " + parsed.getErrorMessage());
+
+        return parsed;
+    }
+
+    int formalOctaveDegree = 0;
+    juce::Array<int> keys;   // the scale degree for each key of the pattern, or -1 if unmapped
+};
+
+//==============================================================================
+namespace ScalaTuning
+{
+    /** Expands a scale, and optionally a keyboard mapping, into a TuningTable.
+        Without a mapping (or with a linear one) each key is one scale degree.
+    */
+    inline std::unique_ptr<TuningTable> compile (const ScalaScale& scale, const ScalaKeyboardMapping* mapping = nullptr)
+    {
+        jassert (scale.getNumDegrees() > 0);
+
+        if (mapping == nullptr || mapping->keys.isEmpty())
+            return std::make_unique<TuningTable> (TuningTable::build (scale.getNumDegrees(), scale.getPeriod(),
+                                                                      [&scale] (int degree) { return scale.ratios.getUnchecked (degree); }));
+
+        auto& keys = mapping->keys;
+
+        auto keyRatio = [&] (int key)
+        {
+            return keys.getUnchecked (key) >= 0 ? scale.getDegreeRatio (keys.getUnchecked (key))
+                                                : std::pow (2.0, key / 12.0);
+        };
+
+        // make the reference note itself the unison even if the pattern doesn't start on degree 0
+        auto unison = keyRatio (0);
+
+        return std::make_unique<TuningTable> (TuningTable::build (keys.size(),
+                                                                  scale.getDegreeRatio (mapping->formalOctaveDegree),
+                                                                  [&] (int key) { return keyRatio (key) / unison; }));
+    }
+}
+
+//==============================================================================
+/** Loads and compiles Scala files on a background thread, keeping the
+    finished tables so that switching between them is just a copy and a
+    publish. Listeners hear about new tunings on the message thread.
+*/
+class ScalaTuningLibrary  : private juce::Thread,
+                           private juce::AsyncUpdater
+{
+public:
+    ScalaTuningLibrary() : juce::Thread ("Scala loader") {}
+
+    ~ScalaTuningLibrary() override
+    {
+        cancelPendingUpdate();
+        stopThread (4000);
+    }
+
+    /** Queues .scl files to be loaded. A .kbm with the same name next to a
+        .scl file is used as its keyboard mapping.
+    */
+    void loadFiles (const juce::Array<juce::File>& files)
+    {
+        {
+            const juce::ScopedLock sl (lock);
+            pendingFiles.addArray (files);
+        }
+
+        startThread();
+        notify();
+    }
+
+    int getNumTunings() const
+    {
+        const juce::ScopedLock sl (lock);
+        return tunings.size();
+    }
+
+    juce::String getTuningName (int index) const
+    {
+        const juce::ScopedLock sl (lock);
+
+        if (auto* tuning = tunings[index])
+            return tuning->name;
+
+        return {};
+    }
+
+    /** Returns a copy of a compiled table, ready to be published, or nullptr. */
+    std::unique_ptr<TuningTable> createTable (int index) const
+    {
+        const juce::ScopedLock sl (lock);
+
+        if (auto* tuning = tunings[index])
+            return std::make_unique<TuningTable> (tuning->table);
+
+        return {};
+    }
+
+    /** Returns the errors from files that couldn't be loaded, and forgets them. */
+    juce::StringArray takeErrors()
+    {
+        const juce::ScopedLock sl (lock);
+        auto result = errors;
+        errors.clear();
+        return result;
+    }
+
+    /** Called on the message thread whenever a batch of files has been loaded. */
+    std::function<void()> onTuningsChanged;
+
+private:
+    struct CompiledTuning
+    {
+        juce::String name;
+        TuningTable table;
+    };
+
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            juce::Array<juce::File> files;
+
+            {
+                const juce::ScopedLock sl (lock);
+                files.swapWith (pendingFiles);
+            }
+
+            if (files.isEmpty())
+            {
+                wait (-1);
+                continue;
+            }
+
+            for (auto& file : files)
+            {
+                if (threadShouldExit())
+                    return;
+
+                auto compiled = std::make_unique<CompiledTuning>();
+                auto result = compileFile (file, *compiled);
+
+                const juce::ScopedLock sl (lock);
+
+                if (result.wasOk())
+                    tunings.add (compiled.release());
+                else
+                    errors.add (result.getErrorMessage());
+            }
+
+            triggerAsyncUpdate();
+        }
+    }
+
+    static juce::Result compileFile (const juce::File& file, CompiledTuning& compiled)
+    {
+        ScalaScale scale;
+        auto result = ScalaScale::load (file, scale);
+
+        if (result.failed())
+            return result;
+
+        ScalaKeyboardMapping mapping;
+        auto mappingFile = file.withFileExtension ("kbm");
+        auto hasMapping = mappingFile.existsAsFile();
+
+        if (hasMapping)
+        {
+            result = ScalaKeyboardMapping::load (mappingFile, mapping);
+
+            if (result.failed())
+                return result;
+        }
+
+        compiled.name = scale.description.isNotEmpty() ? scale.description : file.getFileNameWithoutExtension();
+        compiled.table = *ScalaTuning::compile (scale, hasMapping ? &mapping : nullptr);
+        return juce::Result::ok();
+    }
+
+    void handleAsyncUpdate() override
+    {
+        if (onTuningsChanged != nullptr)
+            onTuningsChanged();
+    }
+
+    juce::CriticalSection lock;
+    juce::Array<juce::File> pendingFiles;
+    juce::OwnedArray<CompiledTuning> tunings;
+    juce::StringArray errors;
+
+    JUCE_DECLARE_NON_COPYABLE (ScalaTuningLibrary)
+};
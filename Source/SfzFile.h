@@ -0,0 +1,268 @@
+/*
+  ==============================================================================
+
+    SfzFile.h
+
+    Reads the subset of the SFZ format needed to map a multi-sampled
+    instrument: which sample plays over which key range and velocity range,
+    and at what root key. Opcodes can be set in <global>, <group> and
+    <region> headers; anything the sampler can't use is ignored.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+struct SfzFile
+{
+    struct Region
+    {
+        juce::File sample;
+        int lowKey = 0, highKey = 127, rootKey = 60;
+        int lowVelocity = 0, highVelocity = 127;
+    };
+
+    /** Parses the text of an .sfz file. Sample paths are relative to baseDirectory. */
+    static juce::Result parse (const juce::String& text, const juce::File& baseDirectory, SfzFile& result)
+    {
+        juce::StringPairArray global, group, region;
+        juce::StringPairArray* current = nullptr;
+        juce::String defaultPath;
+        bool inRegion = false;
+
+        result.regions.clearQuick();
+
+        auto flushRegion = [&]() -> juce::Result
+        {
+            if (! inRegion)
+                return juce::Result::ok();
+
+            // region opcodes override the group's, which override the global ones
+            juce::StringPairArray opcodes (global);
+            opcodes.addArray (group);
+            opcodes.addArray (region);
+
+            inRegion = false;
+            region.clear();
+            return addRegion (opcodes, baseDirectory.getChildFile (defaultPath), result);
+        };
+
+        auto source = stripComments (text);
+        auto p = source.getCharPointer();
+
+        for (;;)
+        {
+            p.incrementToEndOfWhitespace();
+
+            if (p.isEmpty())
+                break;
+
+            if (*p == '<')
+            {
+                auto header = juce::String (p + 1, juce::CharacterFunctions::find (p, juce::CharPointer_ASCII (">")));
+                p = juce::CharacterFunctions::find (p, juce::CharPointer_ASCII (">"));
+
+                if (p.isEmpty())
+                    return juce::Result::fail ("Unterminated header <" + header);
+
+                ++p;
+
+                auto flushed = flushRegion();
+
+                if (flushed.failed())
+                    return flushed;
+
+                if (header == "region")                          { inRegion = true; current = &region; }
+                else if (header == "group" || header == "master") { group.clear(); current = &group; }
+                else if (header == "global")                     { global.clear(); group.clear(); current = &global; }
+                else                                             { current = nullptr; }   // <control>, <curve> etc.
+
+                continue;
+            }
+
+            auto opcodeStart = p;
+            auto equals = juce::CharacterFunctions::find (p, juce::CharPointer_ASCII ("="));
+
+            if (equals.isEmpty())
+                return juce::Result::fail ("Expected an opcode but found " + juce::String (opcodeStart).upToFirstOccurrenceOf ("\n", false, false));
+
+            auto opcode = juce::String (opcodeStart, equals).trim();
+            p = equals + 1;
+            auto valueStart = p;
+            p = findEndOfValue (p);
+            auto value = juce::String (valueStart, p).trim();
+
+            if (opcode == "default_path")
+                defaultPath = value.replaceCharacter ('\\', '/');
+            else if (current != nullptr)
+                current->set (opcode, value);
+        }
+
+        return flushRegion();
+    }
+
+    static juce::Result load (const juce::File& file, SfzFile& result)
+    {
+        if (! file.existsAsFile())
+            return juce::Result::fail ("Couldn't find " + file.getFullPathName());
+
+        auto parsed = parse (file.loadFileAsString(), file.getParentDirectory(), result);
+
+        if (parsed.failed())
+            return juce::Result::fail (file.getFileName() + ": " + parsed.getErrorMessage());
+
+        if (result.regions.isEmpty())
+            return juce::Result::fail (file.getFileName() + ": no regions with a sample");
+
+        return parsed;
+    }
+
+    /** Parses a key given as a MIDI note number or a note name such as c4,
+        f#3 or eb5, where c4 is middle C (60). Returns -1 if it isn't valid.
+    */
+    static int parseKey (const juce::String& value)
+    {
+        if (value.containsOnly ("0123456789"))
+            return value.isNotEmpty() && value.getIntValue() <= 127 ? value.getIntValue() : -1;
+
+        static const int naturals[] = { 9, 11, 0, 2, 4, 5, 7 };   // a to g
+        auto name = value.toLowerCase();
+        auto letter = name[0];
+
+        if (letter < 'a' || letter > 'g')
+            return -1;
+
+        auto pitchClass = naturals[letter - 'a'];
+        auto rest = name.substring (1);
+
+        if (rest.startsWithChar ('#'))       { ++pitchClass; rest = rest.substring (1); }
+        else if (rest.startsWithChar ('b'))  { --pitchClass; rest = rest.substring (1); }
+
+        if (rest.isEmpty() || ! rest.trimCharactersAtStart ("-").containsOnly ("0123456789"))
+            return -1;
+
+        auto key = (rest.getIntValue() + 1) * 12 + pitchClass;
+        return juce::isPositiveAndNotGreaterThan (key, 127) ? key : -1;
+    }
+
+    juce::Array<Region> regions;
+
+private:
+    static juce::Result addRegion (const juce::StringPairArray& opcodes, const juce::File& sampleDirectory, SfzFile& result)
+    {
+        auto samplePath = opcodes["sample"].replaceCharacter ('\\', '/');
+
+        // regions without a sample (e.g. generated waveforms) can't be played by the sampler
+        if (samplePath.isEmpty() || samplePath.startsWithChar ('*'))
+            return juce::Result::ok();
+
+        Region region;
+        region.sample = sampleDirectory.getChildFile (samplePath);
+
+        auto readKey = [&opcodes] (const char* name, int& destination) -> bool
+        {
+            if (! opcodes.containsKey (name))
+                return true;
+
+            destination = parseKey (opcodes[name].trim());
+            return destination >= 0;
+        };
+
+        auto readVelocity = [&opcodes] (const char* name, int& destination) -> bool
+        {
+            if (! opcodes.containsKey (name))
+                return true;
+
+            destination = opcodes[name].getIntValue();
+            return juce::isPositiveAndNotGreaterThan (destination, 127);
+        };
+
+        if (opcodes.containsKey ("key"))
+        {
+            if (! readKey ("key", region.lowKey))
+                return juce::Result::fail ("Invalid key: " + opcodes["key"]);
+
+            region.highKey = region.rootKey = region.lowKey;
+        }
+
+        if (! readKey ("lokey", region.lowKey) || ! readKey ("hikey", region.highKey)
+             || ! readKey ("pitch_keycenter", region.rootKey))
+            return juce::Result::fail ("Invalid key range for " + samplePath);
+
+        if (! readVelocity ("lovel", region.lowVelocity) || ! readVelocity ("hivel", region.highVelocity))
+            return juce::Result::fail ("Invalid velocity range for " + samplePath);
+
+        // an inverted range maps nothing, so the region would never play
+        if (region.lowKey > region.highKey)
+            return juce::Result::fail ("Empty key range for " + samplePath + ": lokey is above hikey");
+
+        if (region.lowVelocity > region.highVelocity)
+            return juce::Result::fail ("Empty velocity range for " + samplePath + ": lovel is above hivel");
+
+        result.regions.add (region);
+        return juce::Result::ok();
+    }
+
+    /** Removes // line comments and block comments. */
+    static juce::String stripComments (const juce::String& text)
+    {
+        juce::String result;
+        auto p = text.getCharPointer();
+
+        while (! p.isEmpty())
+        {
+            if (*p == '/' && p[1] == '/')
+            {
+                while (! p.isEmpty() && *p != '\n')
+                    ++p;
+            }
+            else if (*p == '/' && p[1] == '*')
+            {
+                p += 2;
+
+                while (! p.isEmpty() && ! (*p == '*' && p[1] == '/'))
+                    ++p;
+
+                if (! p.isEmpty())
+                    p += 2;
+            }
+            else
+            {
+                result << *p;
+                ++p;
+            }
+        }
+
+        return result;
+    }
+
+    /** A value runs up to the next header or opcode, so sample paths can contain spaces. */
+    static juce::String::CharPointerType findEndOfValue (juce::String::CharPointerType p)
+    {
+        for (;;)
+        {
+            while (! p.isEmpty() && ! p.isWhitespace() && *p != '<')
+                ++p;
+
+            if (p.isEmpty() || *p == '<')
+                return p;
+
+            auto next = p;
+            next.incrementToEndOfWhitespace();
+
+            if (next.isEmpty() || *next == '<' || startsWithOpcode (next))
+                return p;
+
+            p = next;
+        }
+    }
+
+    static bool startsWithOpcode (juce::String::CharPointerType p)
+    {
+        while (! p.isEmpty() && (p.isLetterOrDigit() || *p == '_'))
+            ++p;
+
+        return *p == '=';
+    }
+};
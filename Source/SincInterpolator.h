@@ -0,0 +1,151 @@
+/*
+  ==============================================================================
+
+    SincInterpolator.h
+
+    Windowed-sinc interpolation for the sampler voice. Just intonation
+    ratios are never whole steps, so every sampled note is resampled at an
+    arbitrary ratio, and the linear interpolation SamplerVoice uses leaves
+    audible images and aliases.
+
+    The kernels are Kaiser-windowed sincs tabulated at a fixed number of
+    fractional positions, with the coefficients for positions in between
+    interpolated linearly. They are built once, off the audio thread. The
+    inner loop keeps four independent sums, so it maps straight onto one
+    SSE/NEON register without needing fast-math to reorder the additions.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+class SincInterpolator
+{
+public:
+    enum class Quality
+    {
+        linear,     // what juce::SamplerVoice does
+        sinc        // the tabulated windowed sinc
+    };
+
+    static constexpr int numTaps = 32;
+    static constexpr int numPhases = 64;
+
+    /** The frames before the interpolated position that a window starts at. */
+    static constexpr int tapsBefore = numTaps / 2 - 1;
+
+    /** Returns the kernel for a voice reading its sample pitchRatio times
+        faster than it was recorded. When the sample is transposed up, the
+        cutoff is lowered in half-octave steps so it doesn't alias.
+    */
+    static const SincInterpolator& forPitchRatio (double pitchRatio) noexcept
+    {
+        auto index = pitchRatio <= 1.0 ? 0 : (int) std::ceil (2.0 * std::log2 (pitchRatio));
+        return getKernels()[(size_t) juce::jmin (index, numKernels - 1)];
+    }
+
+    /** Builds the kernels if that hasn't happened yet. Call this before the
+        audio thread needs them.
+    */
+    static void prepare()
+    {
+        getKernels();
+    }
+
+    /** Interpolates between the frames at window[tapsBefore] and
+        window[tapsBefore + 1]. The window holds numTaps consecutive frames
+        and fraction is in [0, 1).
+    */
+    float interpolate (const float* window, float fraction) const noexcept
+    {
+        auto phase = fraction * (float) numPhases;
+        auto index = juce::jmin ((int) phase, numPhases - 1);
+        auto blend = phase - (float) index;
+
+        const float* c = coefficients.data() + index * numTaps;
+        const float* d = deltas.data() + index * numTaps;
+
+        float sums[4] = {};
+
+        for (int k = 0; k < numTaps; k += 4)
+            for (int j = 0; j < 4; ++j)
+                sums[j] += window[k + j] * (c[k + j] + blend * d[k + j]);
+
+        return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    }
+
+    SincInterpolator() = default;
+
+private:
+    static constexpr int numKernels = 7;     // up to three octaves up; beyond that the top kernel is used
+    static constexpr double baseCutoff = 0.45;   // in cycles per source sample
+    static constexpr double kaiserBeta = 9.0;
+
+    static const std::array<SincInterpolator, numKernels>& getKernels()
+    {
+        static std::array<SincInterpolator, numKernels> kernels;
+
+        static const bool initialised = []
+        {
+            for (size_t i = 0; i < kernels.size(); ++i)
+                kernels[i].build (baseCutoff / std::pow (2.0, (double) i * 0.5));
+
+            return true;
+        }();
+
+        juce::ignoreUnused (initialised);
+        return kernels;
+    }
+
+    void build (double cutoff)
+    {
+        std::array<double, (numPhases + 1) * numTaps> table;
+        constexpr double halfLength = numTaps / 2;
+
+        for (int phase = 0; phase <= numPhases; ++phase)
+        {
+            auto fraction = (double) phase / numPhases;
+            auto* row = table.data() + phase * numTaps;
+            double sum = 0.0;
+
+            for (int k = 0; k < numTaps; ++k)
+            {
+                auto x = (double) (k - tapsBefore) - fraction;
+                auto u = 2.0 * cutoff * x;
+                auto sinc = u == 0.0 ? 1.0 : std::sin (juce::MathConstants<double>::pi * u) / (juce::MathConstants<double>::pi * u);
+                auto w = x / halfLength;
+                auto window = std::abs (w) >= 1.0 ? 0.0 : besselI0 (kaiserBeta * std::sqrt (1.0 - w * w)) / besselI0 (kaiserBeta);
+
+                row[k] = 2.0 * cutoff * sinc * window;
+                sum += row[k];
+            }
+
+            // unity gain at DC for every phase, so a constant signal doesn't pick up ripple
+            for (int k = 0; k < numTaps; ++k)
+                row[k] /= sum;
+        }
+
+        for (int i = 0; i < numPhases * numTaps; ++i)
+        {
+            coefficients[(size_t) i] = (float) table[(size_t) i];
+            deltas[(size_t) i] = (float) (table[(size_t) (i + numTaps)] - table[(size_t) i]);
+        }
+    }
+
+    /** The zeroth-order modified Bessel function of the first kind. */
+    static double besselI0 (double x)
+    {
+        double sum = 1.0, term = 1.0;
+
+        for (int k = 1; k < 32; ++k)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+
+        return sum;
+    }
+
+    std::array<float, numPhases * numTaps> coefficients {}, deltas {};
+};
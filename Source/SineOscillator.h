@@ -0,0 +1,109 @@
+/*
+  ==============================================================================
+
+    SineOscillator.h
+
+    A block-based sine oscillator for SineWaveEngine. The phase is kept in
+    cycles in double precision and wrapped after every chunk, so the just
+    intonation frequency stays exact and long notes don't lose precision.
+
+    The fast mode evaluates a polynomial sine over each chunk. The loop has no
+    branches and no dependency between samples, so the compiler turns it into
+    SSE/AVX/NEON code without any hand-written intrinsics.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+class SineOscillator
+{
+public:
+    enum class Mode
+    {
+        precise,    // std::sin in double precision, as the voice used to do
+        fast        // vectorised polynomial, within about -120 dB of std::sin
+    };
+
+    /** The largest number of samples computed from one double-precision
+        phase. Within a chunk the phase offset is done in float, so this
+        bounds how far the float error can grow.
+    */
+    static constexpr int chunkSize = 64;
+
+    void setMode (Mode newMode) noexcept                 { mode = newMode; }
+    Mode getMode() const noexcept                        { return mode; }
+
+    /** Restarts the waveform at zero phase with the given frequency. */
+    void start (double cyclesPerSample) noexcept
+    {
+        phase = 0.0;
+        increment = cyclesPerSample;
+    }
+
+    void stop() noexcept                                 { increment = 0.0; }
+    bool isActive() const noexcept                       { return increment != 0.0; }
+
+    /** The fast mode's polynomial sine of a phase in cycles, which must not be
+        negative. Inlined into a loop with no dependency between iterations,
+        it vectorises; PartialBank uses it for its partials too.
+    */
+    static float fastSine (float cycles) noexcept
+    {
+        // the phase is never negative, so truncation rounds down
+        auto t = cycles - (float) (int) (cycles + 0.5f);    // [-0.5, 0.5]
+
+        // fold onto the first quarter cycle, where the Taylor series converges fast
+        auto a = std::abs (t);
+        auto x = (0.25f - std::abs (a - 0.25f)) * twoPi;  // [0, pi/2]
+        auto x2 = x * x;
+
+        auto s = x * (1.0f + x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f + x2 * (-1.0f / 5040.0f
+                        + x2 * (1.0f / 362880.0f + x2 * (-1.0f / 39916800.0f))))));
+
+        return t < 0.0f ? -s : s;
+    }
+
+    /** Writes numSamples of the waveform into dest and advances the phase. */
+    void render (float* dest, int numSamples) noexcept
+    {
+        while (numSamples > 0)
+        {
+            auto numThisTime = numSamples < chunkSize ? numSamples : chunkSize;
+
+            if (mode == Mode::fast)
+                renderFastChunk (dest, numThisTime);
+            else
+                renderPreciseChunk (dest, numThisTime);
+
+            phase += increment * numThisTime;
+            phase -= std::floor (phase);
+
+            dest += numThisTime;
+            numSamples -= numThisTime;
+        }
+    }
+
+private:
+    void renderPreciseChunk (float* dest, int numSamples) const noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] = (float) std::sin ((phase + increment * i) * twoPiDouble);
+    }
+
+    void renderFastChunk (float* dest, int numSamples) const noexcept
+    {
+        const auto startPhase = (float) phase;
+        const auto delta = (float) increment;
+
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] = fastSine (startPhase + delta * (float) i);
+    }
+
+    static constexpr double twoPiDouble = 6.283185307179586476925;
+    static constexpr float twoPi = (float) twoPiDouble;
+
+    double phase = 0.0, increment = 0.0;
+    Mode mode = Mode::fast;
+};
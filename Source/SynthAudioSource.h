@@ -0,0 +1,1256 @@
+/*
+  ==============================================================================
+
+    SynthAudioSource.h
+
+    The adaptive-tuning synth engine: the sounds, the two voice types and the
+    SynthAudioSource that drives them. Nothing in here depends on a GUI or an
+    audio device, so the same engine can be driven by MainContentComponent or
+    rendered offline.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "SineOscillator.h"
+#include "Envelope.h"
+#include "PartialBank.h"
+#include "TuningTable.h"
+#include "HeldNoteSet.h"
+#include "TuningReference.h"
+#include "SampleStreamer.h"
+#include "SincInterpolator.h"
+#include "ParallelSynthesiser.h"
+#include "VoicePool.h"
+#include "RealtimeSafetyChecker.h"
+#include "BlockTelemetry.h"
+#include "MidiIngestion.h"
+
+//==============================================================================
+/** The tuning state that used to live in globals at the top of the PIP.
+    Each SynthAudioSource owns one, so several engines can run side by side.
+    Everything in here belongs to the audio thread; the ratios come from an
+    immutable TuningTable that's swapped in at the start of each block.
+*/
+struct AdaptiveTuningState
+{
+    /** Moves the tuning reference to the note the strategy picks (by default
+        the bass) when there's harmony, then
+        returns the pitch of the new note in hertz. The first note after a
+        reset becomes the reference, at firstNotePitch.
+        Every voice type shares this, so it's one lookup and one multiply.
+    */
+    double tuneNote (int midiNoteNumber, double firstNotePitch) noexcept
+    {
+        // base case for 1st note pressed
+        if (firstTime) {
+            tempNum = midiNoteNumber;
+            hertzNum = firstNotePitch;
+            firstTime = false;
+
+            basePitch = firstNotePitch;
+            baseNote = midiNoteNumber;
+            baseDriftCents = driftCents = 0.0;
+            referenceOffset = {};
+        }
+        // only alter note to tune to if there is harmony
+        else if (heldNotes.size() > 1) {
+            // find the note to tune to: the bass, or the chord's root, or its most consonant note
+            referenceNote = TuningReference::findReferenceNote(heldNotes, strategy, *pitchClasses);
+
+            // tune any note that isn't the reference note according to the current tuning system
+            if (tempNum != -2 && tempNum != referenceNote)
+                moveReference(referenceNote);
+        }
+
+        return hertzNum * table->getRatioForInterval(midiNoteNumber - tempNum);
+    }
+
+    /** Moves the reference to another note, a just interval away from the
+        current one. With one of the built-in tables the reference is kept as
+        a base pitch times an exact ratio, so however long it wanders the
+        only rounding is in converting that ratio to a double once. A table
+        without exact ratios, like a Scala tuning, multiplies in floating
+        point and starts a new base from the result.
+    */
+    void moveReference(int newReferenceNote) noexcept
+    {
+        auto interval = newReferenceNote - tempNum;
+
+        if (table->isExact()) {
+            referenceOffset += table->getExponentsForInterval(interval);
+            hertzNum = basePitch * referenceOffset.toDouble();
+            driftCents = baseDriftCents + referenceOffset.toCents() - 100.0 * (newReferenceNote - baseNote);
+        }
+        else {
+            auto ratio = table->getRatioForInterval(interval);
+            hertzNum *= ratio;
+            driftCents += 1200.0 * std::log2(ratio) - 100.0 * interval;
+
+            basePitch = hertzNum;
+            baseNote = newReferenceNote;
+            baseDriftCents = driftCents;
+            referenceOffset = {};
+        }
+
+        tempNum = newReferenceNote;
+    }
+
+    const TuningTable* table = &TuningTable::getDefault();
+    int tempNum = -2;
+    double hertzNum = 0.0;
+    int referenceNote = -2;
+    bool firstTime = true;
+
+    // the reference is basePitch times referenceOffset, and baseNote is where the offset started
+    double basePitch = 0.0;
+    int baseNote = -2;
+    JustIntonation::PrimeExponents referenceOffset;
+
+    /** How far the reference has drifted from the equal tempered pitch of
+        its note, relative to the first note, in cents.
+    */
+    double driftCents = 0.0, baseDriftCents = 0.0;
+    TuningReference::Strategy strategy = TuningReference::Strategy::lowestNote;
+    const TuningReference::PitchClassTable* pitchClasses = &TuningReference::PitchClassTable::get();
+
+    HeldNoteSet heldNotes;
+};
+
+//==============================================================================
+/** The base of the synth's sounds, tagged with the engine that plays them,
+    so a voice can tell which engine to start without a dynamic_cast.
+*/
+struct EngineSound   : public juce::SynthesiserSound
+{
+    enum class Engine
+    {
+        sine,
+        sampler,
+        piano
+    };
+
+    explicit EngineSound (Engine e) : engine (e) {}
+
+    bool appliesToChannel (int) override        { return true; }
+
+    const Engine engine;
+};
+
+//==============================================================================
+struct SineWaveSound   : public EngineSound
+{
+    SineWaveSound() : EngineSound (Engine::sine) {}
+
+    bool appliesToNote    (int) override        { return enabled; }
+
+    bool enabled = true;    // audio thread only
+};
+
+//==============================================================================
+struct PianoSound   : public EngineSound
+{
+    PianoSound() : EngineSound (Engine::piano) {}
+
+    bool appliesToNote    (int) override        { return enabled; }
+
+    bool enabled = false;   // audio thread only
+};
+
+//==============================================================================
+/** The sampler's one permanent sound. The sound itself never changes; the
+    instrument behind it is swapped at the start of a block, so changing
+    samples never touches the synth's sound list or its lock.
+*/
+struct SampledSound   : public EngineSound
+{
+    SampledSound() : EngineSound (Engine::sampler) {}
+
+    bool appliesToNote    (int) override        { return enabled && instrument != nullptr; }
+
+    bool enabled = false;                       // audio thread only
+    SamplerInstrument* instrument = nullptr;    // audio thread only
+};
+
+//==============================================================================
+/** Plays a note of the sine wave sound. */
+class SineWaveEngine
+{
+public:
+    void start (double cyclesPerSample, float velocity, double sampleRate)
+    {
+        level = velocity * gain;
+        peak = 0.0f;
+        envelope.prepare (getEnvelopeParameters(), sampleRate);
+        envelope.reset();
+        envelope.noteOn();
+        oscillator.start (cyclesPerSample);
+    }
+
+    void release()
+    {
+        envelope.noteOff();
+    }
+
+    void stop()
+    {
+        envelope.reset();
+        oscillator.stop();
+    }
+
+    void setOscillatorMode (SineOscillator::Mode mode)   { oscillator.setMode (mode); }
+
+    static double getReleaseSeconds() noexcept      { return getEnvelopeParameters().release; }
+
+    float getLevel() const noexcept
+    {
+        return envelope.getLevel();
+    }
+
+    /** The sine's amplitude is its gain, so the loudest gain applied since the last call is its peak. */
+    float takePeak() noexcept
+    {
+        return std::exchange (peak, 0.0f);
+    }
+
+    /** Adds the note into the buffer. Returns false once it has finished. */
+    bool render (juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples)
+    {
+        // the voice is rendered once into its mono scratch buffer, and only
+        // then added to each output channel with vector adds
+        while (oscillator.isActive() && numSamples > 0)
+        {
+            auto numThisTime = juce::jmin (numSamples, scratchSize);
+            oscillator.render (scratch, numThisTime);
+
+            if (envelope.isSustaining())
+            {
+                juce::FloatVectorOperations::multiply (scratch, level * envelope.getLevel(), numThisTime); // [6]
+                peak = juce::jmax (peak, level * envelope.getLevel());
+            }
+            else
+            {
+                // [7] the release ends where the envelope says, not where a per-sample test finds it
+                numThisTime = envelope.getNextGains (gains, numThisTime);
+                peak = juce::jmax (peak, level * juce::FloatVectorOperations::findMaximum (gains, numThisTime));
+                juce::FloatVectorOperations::multiply (scratch, gains, numThisTime);
+                juce::FloatVectorOperations::multiply (scratch, level, numThisTime);
+
+                if (! envelope.isActive())
+                    oscillator.stop(); // [9]
+            }
+
+            for (auto ch = outputBuffer.getNumChannels(); --ch >= 0;)
+                juce::FloatVectorOperations::add (outputBuffer.getWritePointer (ch, startSample), scratch, numThisTime);
+
+            startSample += numThisTime;
+            numSamples -= numThisTime;
+        }
+
+        return oscillator.isActive();
+    }
+
+private:
+    /** No attack, as before, and a release falling to about -46 dB in 12 ms,
+        which is what multiplying by 0.99 per sample used to give at 44.1 kHz.
+    */
+    static Envelope::Parameters getEnvelopeParameters() noexcept
+    {
+        Envelope::Parameters parameters;
+        parameters.release = 0.012f;
+        parameters.releaseShape = Envelope::Shape::exponential;
+        return parameters;
+    }
+
+    static constexpr int scratchSize = 256;
+    static constexpr float gain = 0.15f;
+
+    SineOscillator oscillator;
+    Envelope envelope;
+    alignas (16) float scratch[scratchSize];
+    alignas (16) float gains[scratchSize];
+    float level = 0.0f, peak = 0.0f;
+};
+
+//==============================================================================
+/** Plays a note of the sampled sound: finds the instrument's zone for it,
+    resamples the zone's sample and applies the instrument's envelope.
+*/
+class SamplerEngine {
+public:
+    /** Without a stream the engine can only play samples that are fully in memory. */
+    SamplerEngine(AdaptiveTuningState& s, SampleStream* sampleStream)
+        : state(s), stream(sampleStream)
+    {
+        SincInterpolator::prepare();
+    }
+
+    /** Takes effect from the next note. */
+    void setInterpolation(SincInterpolator::Quality newQuality)
+    {
+        interpolation = newQuality;
+    }
+
+    /** Returns false if the instrument has nothing to play for this note. */
+    bool start(int midiNoteNumber, float velocity, SamplerInstrument& newInstrument, double sampleRate)
+    {
+        // holding a reference keeps the instrument alive until the note
+        // ends, even if another one has been loaded in the meantime
+        instrument = &newInstrument;
+        auto* zone = instrument->findZone(midiNoteNumber, velocity);
+        sample = zone != nullptr ? zone->sample.get() : nullptr;
+
+        if (sample == nullptr || (sample->isStreamed() && stream == nullptr)) {
+            stop();
+            return false;
+        }
+
+        if (sample->isStreamed())
+            stream->start(*sample);
+
+        // the tuning is kept in hertz, like the sine voice's, since notes from
+        // zones with different roots can't share a reference playback ratio
+        auto cyclesPerSecond = state.tuneNote(midiNoteNumber, juce::MidiMessage::getMidiNoteInHertz(midiNoteNumber));
+        pitchRatio = cyclesPerSecond / juce::MidiMessage::getMidiNoteInHertz(zone->rootNote)
+                       * sample->sourceSampleRate / sampleRate;
+        sourceSamplePosition = 0.0;
+
+        for (auto& span : decodedSpans)
+            span.start = span.end = 0;
+
+        kernel = interpolation == SincInterpolator::Quality::sinc ? &SincInterpolator::forPitchRatio(pitchRatio) : nullptr;
+        lgain = velocity;
+        rgain = velocity;
+
+        // the envelope runs once per output sample, so its times are in terms
+        // of the playback rate, whatever rate the sample was recorded at
+        envelope.prepare(instrument->envelope, sampleRate);
+        envelope.reset();
+        envelope.noteOn();
+        peak = 0.0f;
+        return true;
+    }
+
+    void release()
+    {
+        envelope.noteOff();
+    }
+
+    void stop()
+    {
+        envelope.reset();
+
+        if (stream != nullptr)
+            stream->stop();
+
+        // the publisher still holds the instrument, so this never frees it here
+        sample = nullptr;
+        instrument = nullptr;
+    }
+
+    float getLevel() const noexcept
+    {
+        return juce::jmax(lgain, rgain) * envelope.getLevel();
+    }
+
+    /** The largest magnitude the note has added to either channel since the last call. */
+    float takePeak() noexcept
+    {
+        return std::exchange(peak, 0.0f);
+    }
+
+    /** Adds the note into the buffer. Returns false once it has finished. */
+    bool render(juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples)
+    {
+        if (sample == nullptr)
+            return false;
+
+        float* outL = outputBuffer.getWritePointer(0, startSample);
+        float* outR = outputBuffer.getNumChannels() > 1 ? outputBuffer.getWritePointer(1, startSample) : nullptr;
+
+        auto stillPlaying = [&]
+        {
+            switch (sample->audio.getFormat())
+            {
+                case SampleStorage::Format::int16:  return renderStored<juce::int16>(outL, outR, numSamples);
+                case SampleStorage::Format::half:   return renderStored<SampleStorage::Half>(outL, outR, numSamples);
+                case SampleStorage::Format::float32:
+                default:                            return renderStored<float>(outL, outR, numSamples);
+            }
+        }();
+
+        return stillPlaying;
+    }
+
+private:
+    /** A run of a 16-bit sample's frames, converted to float for the sinc
+        windows to read, kept from block to block.
+    */
+    struct DecodedSpan
+    {
+        static constexpr int capacity = 512;
+
+        juce::int64 start = 0, end = 0;
+        alignas(16) float frames[capacity];
+    };
+
+    /** A sample that's entirely in memory, stored as SampleType. */
+    template <typename SampleType>
+    struct ResidentFrames
+    {
+        /** Without spans, 16-bit windows are converted tap by tap. */
+        explicit ResidentFrames(const SampleBuffer& audio, DecodedSpan* decodedSpans = nullptr) noexcept
+            : channels { audio.getReadPointer<SampleType>(0), audio.getReadPointer<SampleType>(audio.getNumChannels() > 1 ? 1 : 0) },
+              numChannels(audio.getNumChannels()), numFrames(audio.getNumFrames()), spans(decodedSpans) {}
+
+        float getFrame(int channel, juce::int64 frame) const noexcept
+        {
+            return SampleStorage::toFloat(channels[channel][frame]);
+        }
+
+        /** Points straight into float samples, and into the channel's span
+            for 16-bit ones, unless the window hangs off either end. The span
+            is converted a run of frames at a time, in one vectorised loop,
+            and only moved on once a window runs off its end, so each frame
+            is converted once rather than once for every window it's in.
+        */
+        const float* getWindow(int channel, juce::int64 first, float* scratch) const noexcept
+        {
+            if (first >= 0 && first + SincInterpolator::numTaps <= numFrames)
+            {
+                if constexpr (std::is_same<SampleType, float>::value)
+                    return channels[channel] + first;
+
+                if (spans == nullptr)
+                {
+                    SampleStorage::toFloat(channels[channel] + first, scratch, SincInterpolator::numTaps);
+                    return scratch;
+                }
+
+                auto& span = spans[channel];
+
+                if (first < span.start || first + SincInterpolator::numTaps > span.end)
+                {
+                    auto count = (int) juce::jmin((juce::int64) DecodedSpan::capacity, numFrames - first);
+                    SampleStorage::toFloat(channels[channel] + first, span.frames, count);
+                    span.start = first;
+                    span.end = first + count;
+                }
+
+                return span.frames + (first - span.start);
+            }
+
+            for (int i = 0; i < SincInterpolator::numTaps; ++i)
+                scratch[i] = juce::isPositiveAndBelow(first + i, numFrames) ? getFrame(channel, first + i) : 0.0f;
+
+            return scratch;
+        }
+
+        const SampleType* channels[2];
+        int numChannels;
+        juce::int64 numFrames;
+        DecodedSpan* spans;
+    };
+
+    /** A streamed sample: the head from memory, stored as SampleType, and the
+        rest from the voice's stream.
+    */
+    template <typename SampleType>
+    struct StreamedFrames
+    {
+        StreamedFrames(const SampleBuffer& headAudio, const SampleStream& sampleStream) noexcept
+            : head(headAudio), stream(sampleStream), numChannels(headAudio.getNumChannels()),
+              headLength(headAudio.getNumFrames()), available(sampleStream.getAvailableEnd()) {}
+
+        float getFrame(int channel, juce::int64 frame) noexcept
+        {
+            if (frame < 0)
+                return 0.0f;
+
+            if (frame < headLength)
+                return head.getFrame(channel, frame);
+
+            if (frame < available)
+                return stream.getSample(channel, frame);
+
+            starved = true;
+            return 0.0f;
+        }
+
+        const float* getWindow(int channel, juce::int64 first, float* scratch) noexcept
+        {
+            for (int i = 0; i < SincInterpolator::numTaps; ++i)
+                scratch[i] = getFrame(channel, first + i);
+
+            return scratch;
+        }
+
+        ResidentFrames<SampleType> head;
+        const SampleStream& stream;
+        int numChannels;
+        juce::int64 headLength, available;
+        bool starved = false;
+    };
+
+    template <typename SampleType>
+    bool renderStored(float*& outL, float*& outR, int numSamples)
+    {
+        if (! sample->isStreamed())
+        {
+            ResidentFrames<SampleType> frames(sample->audio, decodedSpans);
+            return render(outL, outR, numSamples, frames);
+        }
+
+        // the head is in memory, the rest comes from the stream; re-check what
+        // has arrived every few frames so the streamer can refill mid-block
+        while (numSamples > 0)
+        {
+            auto numThisTime = juce::jmin(numSamples, streamCheckInterval);
+            StreamedFrames<SampleType> frames(sample->audio, *stream);
+
+            if (! render(outL, outR, numThisTime, frames))
+                return false;
+
+            if (frames.starved)
+                stream->reportUnderrun();
+
+            stream->release((juce::int64) sourceSamplePosition - SincInterpolator::tapsBefore);
+            numSamples -= numThisTime;
+        }
+
+        return true;
+    }
+
+    template <typename Frames>
+    bool render(float*& outL, float*& outR, int numSamples, Frames& frames)
+    {
+        return kernel != nullptr ? renderFrames<true>(outL, outR, numSamples, frames)
+                                 : renderFrames<false>(outL, outR, numSamples, frames);
+    }
+
+    /** Mixes numSamples of the note into the output. Returns false if the note ended. */
+    template <bool useSinc, typename Frames>
+    bool renderFrames(float*& outL, float*& outR, int numSamples, Frames& frames)
+    {
+        const auto stereo = frames.numChannels > 1;
+        float window[SincInterpolator::numTaps];
+
+        auto interpolate = [&](int channel, juce::int64 pos, float alpha)
+        {
+            if (useSinc)
+                return kernel->interpolate(frames.getWindow(channel, pos - SincInterpolator::tapsBefore, window), alpha);
+
+            // just using a very simple linear interpolation here..
+            return frames.getFrame(channel, pos) * (1.0f - alpha) + frames.getFrame(channel, pos + 1) * alpha;
+        };
+
+        while (numSamples > 0)
+        {
+            // the envelope's gains come a chunk at a time, and a release that ends
+            // part way through one cuts the chunk short
+            auto numThisTime = envelope.getNextGains(gains, juce::jmin(numSamples, gainChunkSize));
+            auto finished = numThisTime < juce::jmin(numSamples, gainChunkSize);
+            numSamples -= numThisTime;
+
+            for (int i = 0; i < numThisTime; ++i)
+            {
+                auto pos = (juce::int64) sourceSamplePosition;
+                auto alpha = (float) (sourceSamplePosition - (double) pos);
+
+                float l = interpolate(0, pos, alpha);
+                float r = stereo ? interpolate(1, pos, alpha) : l;
+
+                l *= lgain * gains[i];
+                r *= rgain * gains[i];
+                peak = juce::jmax(peak, std::abs(l), std::abs(r));
+
+                if (outR != nullptr)
+                {
+                    *outL++ += l;
+                    *outR++ += r;
+                }
+                else
+                {
+                    *outL++ += (l + r) * 0.5f;
+                }
+
+                sourceSamplePosition += pitchRatio;
+
+                if (sourceSamplePosition > (double) sample->length)
+                {
+                    stop();
+                    return false;
+                }
+            }
+
+            if (finished)
+            {
+                stop();
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static constexpr int streamCheckInterval = 256;
+    static constexpr int gainChunkSize = 64;
+
+    AdaptiveTuningState& state;
+    SampleStream* const stream;
+    SincInterpolator::Quality interpolation = SincInterpolator::Quality::sinc;
+    const SincInterpolator* kernel = nullptr;
+    SamplerInstrument::Ptr instrument;
+    const SampleData* sample = nullptr;
+    double pitchRatio = 0.0, sourceSamplePosition = 0.0;
+    float lgain = 0.0f, rgain = 0.0f, peak = 0.0f;
+    Envelope envelope;
+    float gains[gainChunkSize];
+    DecodedSpan decodedSpans[2];
+};
+
+//==============================================================================
+/** Plays a note of the additive piano. The note is up to 64 partials of one
+    fundamental, each a little sharper than a whole multiple of it, as the
+    stiffness of a real string makes them, and each dying away at its own
+    rate, the higher ones faster. The fundamental comes from the adaptive
+    tuning like any other note's, so every partial is in just intonation
+    with the chord, which no recorded piano can be.
+*/
+class PianoEngine
+{
+public:
+    void start (int midiNoteNumber, double cyclesPerSample, float velocity, double sampleRate)
+    {
+        bank.clear();
+        peak = 0.0f;
+        damperDecay = midiNoteNumber < firstUndampedNote ? getDecayPerSample (damperSeconds, sampleRate) : 1.0f;
+
+        auto inharmonicity = getInharmonicity (midiNoteNumber);
+        auto decaySeconds = getDecaySeconds (midiNoteNumber);
+        auto rolloff = 2.0 - velocity;      // harder strikes are brighter
+        auto total = 0.0;
+
+        for (int n = 1; n <= PartialBank::maxPartials; ++n)
+        {
+            auto partialCycles = cyclesPerSample * n * std::sqrt (1.0 + inharmonicity * n * n);
+
+            if (partialCycles >= maxCyclesPerSample)
+                break;
+
+            // striking an eighth of the way along the string all but silences every eighth partial
+            auto amplitude = std::abs (std::sin (juce::MathConstants<double>::pi * n * strikePosition)) / std::pow ((double) n, rolloff);
+            auto partialDecaySeconds = decaySeconds / (1.0 + partialCycles * sampleRate / decayCornerHz);
+
+            bank.addPartial (partialCycles, (float) amplitude, getDecayPerSample (partialDecaySeconds, sampleRate));
+            total += amplitude;
+        }
+
+        // scaled so that the partials can't add up to more than the sine voice's level
+        if (total > 0.0)
+            bank.applyGain ((float) (velocity * gain / total));
+    }
+
+    void release()
+    {
+        bank.dampen (damperDecay);
+    }
+
+    void stop()
+    {
+        bank.clear();
+    }
+
+    float getLevel() const noexcept
+    {
+        return bank.getTotalAmplitude() / gain;
+    }
+
+    /** How long the longest released note rings on: the lowest string without
+        a damper, until its partials are dropped as silent.
+    */
+    static double getReleaseSeconds() noexcept
+    {
+        return getDecaySeconds (firstUndampedNote) * std::log10 (PartialBank::silenceAmplitude) / -3.0;
+    }
+
+    float takePeak() noexcept
+    {
+        return std::exchange (peak, 0.0f);
+    }
+
+    /** Adds the note into the buffer. Returns false once every partial has died away. */
+    bool render (juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples)
+    {
+        while (bank.isActive() && numSamples > 0)
+        {
+            auto numThisTime = juce::jmin (numSamples, scratchSize);
+
+            // the amplitudes only fall, so where they start is the peak
+            peak = juce::jmax (peak, bank.getTotalAmplitude());
+
+            juce::FloatVectorOperations::clear (scratch, numThisTime);
+            bank.render (scratch, numThisTime);
+
+            for (auto ch = outputBuffer.getNumChannels(); --ch >= 0;)
+                juce::FloatVectorOperations::add (outputBuffer.getWritePointer (ch, startSample), scratch, numThisTime);
+
+            startSample += numThisTime;
+            numSamples -= numThisTime;
+        }
+
+        return bank.isActive();
+    }
+
+private:
+    /** How much the string's stiffness stretches its partials: partial n is at
+        n * sqrt (1 + B * n * n) times the fundamental. Short, stiff treble
+        strings stretch much more than long wound bass ones.
+    */
+    static double getInharmonicity (int midiNoteNumber) noexcept
+    {
+        return 2.5e-4 * std::exp2 ((midiNoteNumber - 60) / 18.0);
+    }
+
+    /** How long the fundamental takes to fall by 60 dB: around 20 s at the
+        bottom of the keyboard, halving every two octaves.
+    */
+    static double getDecaySeconds (int midiNoteNumber) noexcept
+    {
+        return 20.0 * std::exp2 ((21 - midiNoteNumber) / 24.0);
+    }
+
+    static float getDecayPerSample (double secondsTo60dB, double sampleRate) noexcept
+    {
+        return (float) std::pow (0.001, 1.0 / (secondsTo60dB * sampleRate));
+    }
+
+    static constexpr int scratchSize = 256;
+    static constexpr float gain = 0.15f;
+    static constexpr double maxCyclesPerSample = 0.45;     // nothing above 0.9 times Nyquist
+    static constexpr double strikePosition = 1.0 / 8.0;
+    static constexpr double decayCornerHz = 2000.0;        // partials this high die away twice as fast
+    static constexpr double damperSeconds = 0.25;
+    static constexpr int firstUndampedNote = 89;           // the top strings have no dampers
+
+    PartialBank bank;
+    alignas (16) float scratch[scratchSize];
+    float peak = 0.0f, damperDecay = 1.0f;
+};
+
+//==============================================================================
+/** The synth's one voice type. It plays whichever sound it's started with
+    through the matching engine, so every voice is available to whichever
+    sound is in use.
+*/
+class SynthVoice   : public StealableVoice
+{
+public:
+    /** Without a streamer the voice can only play samples that are fully in memory. */
+    SynthVoice (AdaptiveTuningState& s, SampleStreamer* sampleStreamer = nullptr)
+        : state (s), streamer (sampleStreamer),
+          stream (sampleStreamer != nullptr ? sampleStreamer->createStream() : nullptr),
+          sampler (s, stream)
+    {
+    }
+
+    ~SynthVoice() override
+    {
+        sampler.stop();
+
+        if (streamer != nullptr)
+            streamer->destroyStream (stream);
+    }
+
+    /** Every sound in the synth is an EngineSound, and every voice has both
+        engines, so there's nothing to check.
+    */
+    bool canPlaySound (juce::SynthesiserSound*) override     { return true; }
+
+    void startNote (int midiNoteNumber, float velocity,
+                    juce::SynthesiserSound* sound, int /*currentPitchWheelPosition*/) override
+    {
+        engine = static_cast<const EngineSound*> (sound)->engine;
+        samplesSinceRelease = -1;
+
+        if (engine == EngineSound::Engine::sine)
+        {
+            // the first note is simply played as if it's equal temperament
+            double cyclesPerSecond = state.tuneNote (midiNoteNumber, juce::MidiMessage::getMidiNoteInHertz (midiNoteNumber));
+            sine.start (cyclesPerSecond / getSampleRate(), velocity, getSampleRate());
+        }
+        else if (engine == EngineSound::Engine::piano)
+        {
+            double cyclesPerSecond = state.tuneNote (midiNoteNumber, juce::MidiMessage::getMidiNoteInHertz (midiNoteNumber));
+            piano.start (midiNoteNumber, cyclesPerSecond / getSampleRate(), velocity, getSampleRate());
+        }
+        else
+        {
+            auto* instrument = static_cast<const SampledSound*> (sound)->instrument;
+            jassert (instrument != nullptr);
+
+            if (instrument == nullptr || ! sampler.start (midiNoteNumber, velocity, *instrument, getSampleRate()))
+                clearCurrentNote();
+        }
+    }
+
+    void stopNote (float /*velocity*/, bool allowTailOff) override
+    {
+        if (allowTailOff)
+        {
+            if (samplesSinceRelease < 0)
+                samplesSinceRelease = 0;
+
+            if (engine == EngineSound::Engine::sine)
+                sine.release();
+            else if (engine == EngineSound::Engine::piano)
+                piano.release();
+            else
+                sampler.release();
+        }
+        else
+        {
+            clearCurrentNote();
+            sine.stop();
+            piano.stop();
+            sampler.stop();
+        }
+    }
+
+    void pitchWheelMoved (int) override      {}
+    void controllerMoved (int, int) override {}
+
+    void setOscillatorMode (SineOscillator::Mode mode)               { sine.setOscillatorMode (mode); }
+
+    /** Takes effect from the next note. */
+    void setInterpolation (SincInterpolator::Quality quality)        { sampler.setInterpolation (quality); }
+
+    float getCurrentLevel() const noexcept override
+    {
+        switch (engine)
+        {
+            case EngineSound::Engine::sine:     return sine.getLevel();
+            case EngineSound::Engine::piano:    return piano.getLevel();
+            case EngineSound::Engine::sampler:
+            default:                            return sampler.getLevel();
+        }
+    }
+
+    juce::int64 getSamplesSinceRelease() const noexcept override    { return samplesSinceRelease; }
+
+    float takePeakLevel() noexcept override
+    {
+        switch (engine)
+        {
+            case EngineSound::Engine::sine:     return sine.takePeak();
+            case EngineSound::Engine::piano:    return piano.takePeak();
+            case EngineSound::Engine::sampler:
+            default:                            return sampler.takePeak();
+        }
+    }
+
+    void renderNextBlock (juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples) override
+    {
+        auto stillPlaying = [&]
+        {
+            switch (engine)
+            {
+                case EngineSound::Engine::sine:     return sine.render (outputBuffer, startSample, numSamples);
+                case EngineSound::Engine::piano:    return piano.render (outputBuffer, startSample, numSamples);
+                case EngineSound::Engine::sampler:
+                default:                            return sampler.render (outputBuffer, startSample, numSamples);
+            }
+        }();
+
+        if (! stillPlaying)
+        {
+            if (isVoiceActive())
+                clearCurrentNote();
+        }
+        else if (samplesSinceRelease >= 0)
+        {
+            samplesSinceRelease += numSamples;
+        }
+    }
+    using SynthesiserVoice::renderNextBlock;
+
+private:
+    AdaptiveTuningState& state;
+    SampleStreamer* const streamer;
+    SampleStream* const stream;
+    EngineSound::Engine engine = EngineSound::Engine::sine;
+    SineWaveEngine sine;
+    PianoEngine piano;
+    SamplerEngine sampler;
+    juce::int64 samplesSinceRelease = -1;
+};
+
+
+//==============================================================================
+class SynthAudioSource   : public juce::AudioSource
+{
+public:
+    SynthAudioSource (juce::MidiKeyboardState& keyState)
+        : midiInput (keyState)
+    {
+        createVoices(); // [1]
+
+        // both sounds stay in the synth for good; switching between them is just a flag
+        synth.addSound(sineSound = new SineWaveSound()); // [2]
+        synth.addSound(sampledSound = new SampledSound());
+        synth.addSound(pianoSound = new PianoSound());
+        mFormatManager.registerBasicFormats();
+    }
+
+    /** Add this as each MIDI input device's callback, after giving the
+        device a queue with MidiIngestion::addInput().
+    */
+    MidiIngestion& getMidiInput()
+    {
+        return midiInput;
+    }
+
+    int getNumActiveVoices() const
+    {
+        int numActive = 0;
+
+        for (int i = 0; i < synth.getNumVoices(); ++i)
+            if (synth.getVoice(i)->isVoiceActive())
+                ++numActive;
+
+        return numActive;
+    }
+
+    /** Switches to the built-in table for a limit from its next block. The
+        tables are built at compile time, so this can be called from any
+        thread, including the audio thread just before a block.
+    */
+    void setTuningLimit(int limitId)
+    {
+        tuningTables.publish(TuningTable::getForLimit(limitId));
+    }
+
+    /** Hands an already compiled table, e.g. from a Scala file, to the audio thread. */
+    void setTuningTable(std::unique_ptr<TuningTable> table)
+    {
+        jassert(table != nullptr);
+        tuningTables.publish(std::move(table));
+    }
+
+    /** Chooses which held note the tuning follows when there's harmony. The
+        audio thread switches over at its next block.
+    */
+    void setReferenceStrategy(TuningReference::Strategy newStrategy)
+    {
+        referenceStrategy = newStrategy;
+    }
+
+    /** How many cents the tuning reference has drifted from equal
+        temperament since the last reset, as of the last audio block.
+    */
+    double getPitchDriftCents() const noexcept
+    {
+        return pitchDriftCents.load();
+    }
+
+    static juce::String describePitchDrift(double cents)
+    {
+        return "Drift " + juce::String(cents >= 0.0 ? "+" : "") + juce::String(cents, 1) + " cents";
+    }
+
+    void resetPitchDrift()
+    {
+        pitchDriftResetPending = true;
+    }
+
+    /** Switches every voice between the vectorised and the std::sin oscillator. */
+    void setUsingFastOscillator(bool shouldUseFast)
+    {
+        oscillatorMode = shouldUseFast ? SineOscillator::Mode::fast : SineOscillator::Mode::precise;
+
+        for (int i = 0; i < synth.getNumVoices(); ++i)
+            static_cast<SynthVoice*>(synth.getVoice(i))->setOscillatorMode(oscillatorMode);
+    }
+
+    /** Switches every voice between windowed-sinc and linear interpolation for sampled notes. */
+    void setSamplerInterpolation(SincInterpolator::Quality quality)
+    {
+        interpolation = quality;
+
+        for (int i = 0; i < synth.getNumVoices(); ++i)
+            static_cast<SynthVoice*>(synth.getVoice(i))->setInterpolation(quality);
+    }
+
+    /** Sets how many notes can sound at once. Every voice plays either sound,
+        so this is the polyphony of whichever one is in use. The voices are
+        rebuilt at the next prepareToPlay().
+    */
+    void setPolyphony(int numVoices)
+    {
+        jassert(numVoices > 0);
+        polyphony = numVoices;
+    }
+
+    int getPolyphony() const noexcept
+    {
+        return polyphony;
+    }
+
+    /** Ends notes early once they've stayed more than this many dB below the
+        loudest sample of the mix, or below -120 dBFS, for 50 ms, which frees
+        their voices and the time they take to render. -80 by default; -100
+        or lower turns it off.
+    */
+    void setAudibilityFloor(float decibelsBelowMix)
+    {
+        audibilityFloor = juce::Decibels::decibelsToGain(decibelsBelowMix);
+    }
+
+    /** The number of notes ended early because they'd become inaudible. */
+    int getNumCulledVoices() const noexcept
+    {
+        return numCulledVoices.load();
+    }
+
+    /** Shares the voices out between numThreads worker threads and the audio
+        thread. Zero, the default, renders them all on the audio thread.
+    */
+    void setNumRenderThreads(int numThreads)
+    {
+        synth.setNumRenderThreads(numThreads);
+    }
+
+    void setUsingSineWaveSound()
+    {
+        selectSound(EngineSound::Engine::sine);
+    }
+
+    /** Switches to the additive piano, which needs nothing loading. */
+    void setUsingPianoSound()
+    {
+        selectSound(EngineSound::Engine::piano);
+    }
+
+    /** Switches to the sampled sound. The sine wave keeps playing until the
+        first sample is ready, and after that the previous sample keeps
+        playing until the new one is, so there's never a silent gap.
+    */
+    void setUsingSampledSound()
+    {
+        selectSound(EngineSound::Engine::sampler);
+        streamer.start();
+    }
+
+    /** Switches sound from the next block, like the calls above, but without
+        starting the sample streamer, so the audio thread can call it just
+        before a block. The streamer is started by loading a sample.
+    */
+    void selectSound(EngineSound::Engine engine)
+    {
+        resetPitchDrift();
+        selectedEngine = engine;
+    }
+
+    /** How long the current sound can go on for once its notes are released. */
+    double getTailLengthSeconds() const noexcept
+    {
+        switch (selectedEngine.load())
+        {
+            case EngineSound::Engine::sine:     return SineWaveEngine::getReleaseSeconds();
+            case EngineSound::Engine::piano:    return PianoEngine::getReleaseSeconds();
+            case EngineSound::Engine::sampler:
+            default:                            return juce::jmax(SineWaveEngine::getReleaseSeconds(), (double) samplerReleaseSeconds.load());
+        }
+    }
+
+    /** Loads an audio file, mapped across the keyboard, or an .sfz instrument
+        in the background, streaming long samples from disk.
+    */
+    void loadSampledSoundAsync(const juce::File& wavFile)
+    {
+        streamer.start();
+        sampleLoader.loadAsync(wavFile);
+    }
+
+    /** Loads an audio file, mapped across the keyboard, or an .sfz instrument
+        without going through a FileChooser, so headless callers can pick the
+        sample themselves. Everything is decoded on the calling thread.
+        Returns false if something couldn't be read.
+    */
+    bool loadSampledSound(const juce::File& wavFile)
+    {
+        if (sampleLoader.loadNow(wavFile).failed())
+            return false;
+
+        resetPitchDrift();
+        selectedEngine = EngineSound::Engine::sampler;
+        return true;
+    }
+
+    /** The number of times a streaming voice has run out of data from disk. */
+    int getNumStreamUnderruns() const
+    {
+        return streamer.getNumUnderruns();
+    }
+
+    /** How long blocks, and the stages within them, take to render. */
+    BlockTelemetry& getTelemetry() noexcept
+    {
+        return telemetry;
+    }
+
+    /** Lets the GUI follow the progress of background sample loads. */
+    SampleLoader& getSampleLoader()
+    {
+        return sampleLoader;
+    }
+
+    void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override
+    {
+        if (synth.getNumVoices() != polyphony)
+            createVoices();
+
+        synth.setCurrentPlaybackSampleRate(sampleRate);
+        synth.setMaximumBlockSize(samplesPerBlockExpected);
+        cullHoldSamples = juce::roundToInt(cullHoldSeconds * sampleRate);
+        incomingMidi.ensureSize(midiBufferBytes);
+        telemetry.prepare(sampleRate);
+        midiInput.reset(sampleRate); // [10]
+    }
+
+    void releaseResources() override {}
+
+    void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill) override
+    {
+        RealtimeSafety::ScopedAudioBlock audioBlock;
+        auto timer = telemetry.startBlock();
+        bufferToFill.clearActiveBufferRegion();
+
+        // reused, so a block's MIDI only allocates if it outgrows every block so far
+        incomingMidi.clear();
+        midiInput.collectLiveBlock(incomingMidi, bufferToFill.numSamples); // [11]
+        timer.endStage(BlockTelemetry::Stage::midiCollection);
+
+        renderBlock(*bufferToFill.buffer, incomingMidi,
+            bufferToFill.startSample, bufferToFill.numSamples, timer);
+    }
+
+    /** Renders one block from an explicit MIDI buffer, bypassing the device
+        queues, as the plugin and the offline renderer do. Notes played on the
+        on-screen keyboard are added at the start of the block, in a copy, so
+        midi itself is left as it is.
+    */
+    void renderNextBlock(juce::AudioBuffer<float>& outputBuffer, juce::MidiBuffer& midi,
+                         int startSample, int numSamples)
+    {
+        RealtimeSafety::ScopedAudioBlock audioBlock;
+        auto timer = telemetry.startBlock();
+
+        // the live path never runs alongside this one, so its buffer is free
+        auto& blockMidi = midiInput.collectKeyboard(midi, incomingMidi, startSample) ? incomingMidi : midi;
+        timer.endStage(BlockTelemetry::Stage::midiCollection);
+
+        renderBlock(outputBuffer, blockMidi, startSample, numSamples, timer);
+    }
+
+private:
+    /** The live path and the offline renderer both end up here. */
+    void renderBlock(juce::AudioBuffer<float>& outputBuffer, juce::MidiBuffer& midi,
+                     int startSample, int numSamples, BlockTelemetry::BlockTimer& timer)
+    {
+        // the device callback usually sets this already, but the offline
+        // renderer and the benchmarks don't go through one, and fading tails
+        // would otherwise spend their last seconds on denormals
+        juce::ScopedNoDenormals noDenormals;
+
+        // take one consistent snapshot of the tuning for the whole block
+        tuningState.table = &tuningTables.acquire();
+
+        if (pitchDriftResetPending.exchange(false))
+            tuningState.firstTime = true;
+
+        tuningState.strategy = referenceStrategy.load();
+
+        // likewise pick up the current instrument, and fall back to the sine
+        // wave while no sample has been loaded yet
+        auto* instrument = instruments.acquire();
+        auto engine = selectedEngine.load();
+
+        if (engine == EngineSound::Engine::sampler && instrument == nullptr)
+            engine = EngineSound::Engine::sine;
+
+        if (instrument != nullptr)
+            samplerReleaseSeconds = instrument->envelope.release;
+
+        sampledSound->instrument = instrument;
+        sampledSound->enabled = engine == EngineSound::Engine::sampler;
+        sineSound->enabled = engine == EngineSound::Engine::sine;
+        pianoSound->enabled = engine == EngineSound::Engine::piano;
+
+        // the buffer already includes notes played on the on-screen keyboard,
+        // so the held notes are tracked here on the audio thread rather than
+        // from keyboard state callbacks, which fire on the message thread
+        for (const auto metadata : midi)
+            tuningState.heldNotes.processMidiMessage(metadata.getMessage());
+
+        timer.endStage(BlockTelemetry::Stage::keyboardState);
+
+        synth.renderNextBlock(outputBuffer, midi,
+            startSample, numSamples);
+
+        pitchDriftCents = tuningState.firstTime ? 0.0 : tuningState.driftCents;
+
+        auto floor = audibilityFloor.load();
+
+        if (floor > 0.0f)
+        {
+            auto threshold = juce::jmax(silenceThreshold, floor * outputBuffer.getMagnitude(startSample, numSamples));
+            numCulledVoices += synth.cullInaudibleVoices(threshold, numSamples, cullHoldSamples);
+        }
+
+        timer.endStage(BlockTelemetry::Stage::synthRender);
+        telemetry.finishBlock(timer, numSamples, synth.getNumPlayingVoices());
+    }
+
+    void createVoices()
+    {
+        synth.setVoices(polyphony, [this](int)
+            {
+                auto* voice = new SynthVoice(tuningState, &streamer);
+                voice->setOscillatorMode(oscillatorMode);
+                voice->setInterpolation(interpolation);
+                return voice;
+            });
+    }
+
+    static constexpr int defaultPolyphony = 16;
+    static constexpr int midiBufferBytes = 4096;     // about 450 three-byte events a block before it allocates
+    static constexpr double cullHoldSeconds = 0.05;
+    static constexpr float silenceThreshold = 1.0e-6f;     // -120 dBFS
+
+    AdaptiveTuningState tuningState;
+    TuningTablePublisher tuningTables;
+    std::atomic<bool> pitchDriftResetPending { false };
+    std::atomic<double> pitchDriftCents { 0.0 };
+    std::atomic<TuningReference::Strategy> referenceStrategy { TuningReference::Strategy::lowestNote };
+    SamplerInstrumentPublisher instruments;
+    SampleStreamer streamer { instruments };      // must outlive the voices using its streams
+    ParallelSynthesiser synth;
+    int polyphony = defaultPolyphony;
+    std::atomic<float> audibilityFloor { 1.0e-4f };     // -80 dB
+    std::atomic<int> numCulledVoices { 0 };
+    int cullHoldSamples = 0;
+    SineOscillator::Mode oscillatorMode = SineOscillator::Mode::fast;
+    SincInterpolator::Quality interpolation = SincInterpolator::Quality::sinc;
+    SineWaveSound* sineSound = nullptr;
+    SampledSound* sampledSound = nullptr;
+    PianoSound* pianoSound = nullptr;
+    std::atomic<EngineSound::Engine> selectedEngine { EngineSound::Engine::sine };
+    std::atomic<float> samplerReleaseSeconds { Envelope::Parameters().release };
+    MidiIngestion midiInput;
+    juce::MidiBuffer incomingMidi;      // audio thread only
+    BlockTelemetry telemetry;
+    AudioFormatManager mFormatManager;
+    SampleLoader sampleLoader { mFormatManager, instruments };
+};
@@ -45,423 +45,12 @@
 *******************************************************************************/
 
 #pragma once
-double MinSec = 15.0/14.0;
-double MajSec = 8.0 / 7.0;
-double MinThi = 6.0/5.0;
-double MajThi = 5.0 / 4.0;
-double Fou = 4.0/3.0;
-double TT = 7.0/5.0;
-double Fif = 3.0/2.0;
-double MinSix = 8.0/5.0;
-double MajSix = 5.0/3.0;
-double MinSev = 7.0/4.0;
-double MajSev = 15.0/8.0;
-double Oct = 2.0;
-int tempNum = -2;
-double hertzNum = 0.0;
-int minimum = -2;
-bool firstTime = true;
-
-std::vector<int> notes;
-#pragma once
-
-//==============================================================================
-struct SineWaveSound   : public juce::SynthesiserSound
-{
-    SineWaveSound() {}
 
-    bool appliesToNote    (int) override        { return true; }
-    bool appliesToChannel (int) override        { return true; }
-};
-
-//==============================================================================
-struct SineWaveVoice   : public juce::SynthesiserVoice
-{
-    SineWaveVoice() {}
-
-    bool canPlaySound (juce::SynthesiserSound* sound) override
-    {
-        return dynamic_cast<SineWaveSound*> (sound) != nullptr;
-    }
-    
-    void startNote (int midiNoteNumber, float velocity,
-                    juce::SynthesiserSound*, int /*currentPitchWheelPosition*/) override
-    {
-        
-        currentAngle = 0.0;
-        level = velocity * 0.15;
-        tailOff = 0.0;
-
-        // base case for 1st note pressed (simply play the note as if it's equal temperament)
-        if (firstTime == true) {
-            tempNum = midiNoteNumber;
-            hertzNum = juce::MidiMessage::getMidiNoteInHertz(tempNum);
-            firstTime = false;
-        }
-        // case for next notes
-        else {
-            // only alter note to tune to if there is harmony
-            if (notes.size() > 1) {
-                // find the lowest note (bass note)
-                auto min = min_element(notes.begin(), notes.end());
-                minimum = *min;
-
-                // tune any note that isn't the bass note according to the current tuning system
-                if (tempNum != -2 && tempNum != minimum) {
-                    int tempInterval = minimum - tempNum;
-                    int tempOctave = (tempInterval - (tempInterval % 12)) / 12;
-                    tempInterval = tempInterval % 12;
-                    if (tempInterval <= 0) {
-                        tempInterval += 12;
-                        tempOctave -= 1;                    }
-                    hertzNum *= ratioTable(tempInterval) * (pow(Oct, tempOctave));
-                    tempNum = minimum;
-                }
-
-            }
-        }
-
-        
-        intervalNum = midiNoteNumber - tempNum;
-        octaveNum = (intervalNum - (intervalNum % 12)) / 12;
-        intervalNum = intervalNum % 12;
-        if (intervalNum < 0) {
-            intervalNum += 12;
-            octaveNum -= 1;
-        }
-        ratioNum = ratioTable(intervalNum);
-        if (intervalNum == 0) {
-            ratioNum = 1.0;
-
-        }
-        
-        double cyclesPerSecond = hertzNum * ratioNum * (pow(Oct, octaveNum));
-        double cyclesPerSample = (cyclesPerSecond) / getSampleRate();
-        angleDelta = cyclesPerSample * 2.0 * juce::MathConstants<double>::pi;
-        
-    }
-
-    double ratioTable(int interval) {
-        if (interval == 1) {
-            return MinSec;
-        }
-        else if (interval == 2) {
-            return MajSec;
-        }
-        else if (interval == 3) {
-            return MinThi;
-        }
-        else if (interval == 4) {
-            return MajThi;
-        }
-        else if (interval == 5) {
-            return Fou;
-        }
-        else if (interval == 6) {
-            return TT;
-        }
-        else if (interval == 7) {
-            return Fif;
-        }
-        else if (interval == 8) {
-            return MinSix;
-        }
-        else if (interval == 9) {
-            return MajSix;
-        }
-        else if (interval == 10) {
-            return MinSev;
-        }
-        else if (interval == 11) {
-            return MajSev;
-        }
-        return Oct;
-    }
-
-    void stopNote (float /*velocity*/, bool allowTailOff) override
-    {
-        if (allowTailOff)
-        {
-            if (tailOff == 0.0)
-                tailOff = 1.0;
-            
-        }
-        else
-        {   
-            clearCurrentNote();
-            angleDelta = 0.0;
-        }
-    }
-
-    void pitchWheelMoved (int) override      {}
-    void controllerMoved (int, int) override {}
-
-    void renderNextBlock (juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples) override
-    {
-        if (angleDelta != 0.0)
-        {
-            if (tailOff > 0.0) // [7]
-            {
-                while (--numSamples >= 0)
-                {
-                    auto currentSample = (float) (std::sin (currentAngle) * level * tailOff);
-
-                    for (auto i = outputBuffer.getNumChannels(); --i >= 0;)
-                        outputBuffer.addSample (i, startSample, currentSample);
-
-                    currentAngle += angleDelta;
-                    ++startSample;
-
-                    tailOff *= 0.99; // [8]
-
-                    if (tailOff <= 0.005)
-                    {
-                        clearCurrentNote(); // [9]
-
-                        angleDelta = 0.0;
-                        break;
-                    }
-                }
-            }
-            else
-            {
-                while (--numSamples >= 0) // [6]
-                {
-                    auto currentSample = (float) (std::sin (currentAngle) * level);
-
-                    for (auto i = outputBuffer.getNumChannels(); --i >= 0;)
-                        outputBuffer.addSample (i, startSample, currentSample);
-
-                    currentAngle += angleDelta;
-                    ++startSample;
-                }
-            }
-        }
-    }
-    using SynthesiserVoice::renderNextBlock;
-
-private:
-    double currentAngle = 0.0, angleDelta = 0.0, level = 0.0, tailOff = 0.0;
-    int intervalNum = 0;
-    int octaveNum = 0;
-    double ratioNum = 1.0;
-};
-
-//=============================================================================
-
-class MySamplerVoice : public juce::SamplerVoice {
-public:
-    MySamplerVoice() {}
-
-    // Destructor
-    ~MySamplerVoice() override {}
-
-    void pitchWheelMoved(int) override {}
-    void controllerMoved(int, int) override {}
-
-    void startNote(int midiNoteNumber, float velocity,
-        juce::SynthesiserSound* s, int /*currentPitchWheelPosition*/) override
-    {
-        const SamplerSound* const sound = dynamic_cast<const SamplerSound*>(s);
-        jassert(sound != 0);
-        if (sound != 0) {
-            if (firstTime == true) {
-                hertzNum = 1.0;
-                tempNum = midiNoteNumber;
-                if (tempNum != -2 && tempNum != 60) {
-                    int tempInterval = tempNum - 60;
-                    int tempOctave = (tempInterval - (tempInterval % 12)) / 12;
-                    tempInterval = tempInterval % 12;
-                    if (tempInterval <= 0) {
-                        tempInterval += 12;
-                        tempOctave -= 1;
-                    }
-                    hertzNum *= ratioTable(tempInterval) * (pow(Oct, tempOctave));
-                }
-                firstTime = false;
-            }
-            else {
-                if (notes.size() > 1) {
-                    auto min = min_element(notes.begin(), notes.end());
-                    minimum = *min;
-                    if (tempNum != -2 && tempNum != minimum) {
-                        int tempInterval = minimum - tempNum;
-                        int tempOctave = (tempInterval - (tempInterval % 12)) / 12;
-                        tempInterval = tempInterval % 12;
-                        if (tempInterval <= 0) {
-                            tempInterval += 12;
-                            tempOctave -= 1;
-                        }
-                        hertzNum *= ratioTable(tempInterval) * (pow(Oct, tempOctave));
-                        tempNum = minimum;
-                    }
-
-                }
-            }
-
-
-            intervalNum = midiNoteNumber - tempNum;
-            octaveNum = (intervalNum - (intervalNum % 12)) / 12;
-            intervalNum = intervalNum % 12;
-            if (intervalNum < 0) {
-                intervalNum += 12;
-                octaveNum -= 1;
-            }
-            ratioNum = ratioTable(intervalNum);
-            if (intervalNum == 0) {
-                ratioNum = 1.0;
-
-            }
-
-            pitchRatio = ratioNum * (pow(Oct, octaveNum)) * hertzNum;
-            sourceSamplePosition = 0.0;
-            lgain = velocity;
-            rgain = velocity;
-
-            adsr.setSampleRate(sound->sourceSampleRate);
-            adsr.setParameters(sound->params);
-
-            adsr.noteOn();
-        }
-    }
-
-    double ratioTable(int interval) {
-        if (interval == 1) {
-            return MinSec;
-        }
-        else if (interval == 2) {
-            return MajSec;
-        }
-        else if (interval == 3) {
-            return MinThi;
-        }
-        else if (interval == 4) {
-            return MajThi;
-        }
-        else if (interval == 5) {
-            return Fou;
-        }
-        else if (interval == 6) {
-            return TT;
-        }
-        else if (interval == 7) {
-            return Fif;
-        }
-        else if (interval == 8) {
-            return MinSix;
-        }
-        else if (interval == 9) {
-            return MajSix;
-        }
-        else if (interval == 10) {
-            return MinSev;
-        }
-        else if (interval == 11) {
-            return MajSev;
-        }
-        return Oct;
-    }
-    
-    using SynthesiserVoice::renderNextBlock;
-
-private:
-    int intervalNum = 0;
-    int octaveNum = 0;
-    double ratioNum = 1.0;
-};
-
-
-//==============================================================================
-class SynthAudioSource   : public juce::AudioSource
-
-{
-public:
-    SynthAudioSource (juce::MidiKeyboardState& keyState)
-        : keyboardState (keyState)
-    {
-        
-        for (auto i = 0; i < 12; ++i) {               // [1]
-            synth.addVoice(new SineWaveVoice());
-            synth.addVoice(new MySamplerVoice());
-        }
-        setUsingSineWaveSound(); // [2]
-    }
-
-    juce::MidiMessageCollector* getMidiCollector()
-    {
-        return &midiCollector;
-    }
-
-    void setUsingSineWaveSound()
-    {
-        firstTime = true;
-        synth.clearSounds();
-        synth.addSound(new SineWaveSound());
-    }
-
-    void setUsingSampledSound()
-    {
-        firstTime = true;
-        synth.clearSounds();
-        mFormatManager.registerBasicFormats();
-        myChooser = std::make_unique<juce::FileChooser>("Please select the wav you want to load...",
-            juce::File::getSpecialLocation(juce::File::userHomeDirectory),
-            "*.wav");
-
-        auto folderChooserFlags = juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles | juce::FileBrowserComponent::canSelectDirectories;
-        myChooser->launchAsync(folderChooserFlags, [this](const juce::FileChooser& chooser)
-            {
-                juce::File wavFile = chooser.getResult();
-                    mFormatReader = mFormatManager.createReaderFor(wavFile);
-                    if (mFormatReader != nullptr) {
-                        BigInteger range;
-                        range.setRange(0, 128, true);
-                        
-                        synth.addSound(new SamplerSound("demo sound",
-                            *mFormatReader,
-                            range,
-                            60,   // root midi note
-                            0.0,  // attack time
-                            0.1,  // release time
-                            1000.0  // maximum sample length
-                        ));  
-                    }
-            });
-    }
-
-    void prepareToPlay(int /*samplesPerBlockExpected*/, double sampleRate) override
-    {
-        synth.setCurrentPlaybackSampleRate(sampleRate);
-        midiCollector.reset(sampleRate); // [10]
-    }
-
-    void releaseResources() override {}
-
-    void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill) override
-    {
-        bufferToFill.clearActiveBufferRegion();
-
-        juce::MidiBuffer incomingMidi;
-        midiCollector.removeNextBlockOfMessages(incomingMidi, bufferToFill.numSamples); // [11]
-
-        keyboardState.processNextMidiBuffer(incomingMidi, bufferToFill.startSample,
-            bufferToFill.numSamples, true);
-
-        synth.renderNextBlock(*bufferToFill.buffer, incomingMidi,
-            bufferToFill.startSample, bufferToFill.numSamples);
-    }
-private:
-    juce::MidiKeyboardState& keyboardState;
-    juce::Synthesiser synth;
-    juce::MidiMessageCollector midiCollector;
-    AudioFormatManager mFormatManager;
-    AudioFormatReader* mFormatReader{ nullptr };
-    std::unique_ptr<FileChooser> myChooser;
-};
+#include "SynthAudioSource.h"
+#include "ScalaTuning.h"
 
 //==============================================================================
 class MainContentComponent   : public juce::AudioAppComponent,
-                               private juce::MidiKeyboardStateListener,
                                private juce::Timer
 {
 public:
@@ -471,7 +60,6 @@ public:
 
     {
         addAndMakeVisible (keyboardComponent);
-        keyboardState.addListener (this);
         setAudioChannels (0, 2);
         addAndMakeVisible(sineButton);
         sineButton.setRadioGroupId(321);
@@ -480,15 +68,52 @@ public:
 
         addAndMakeVisible(sampledButton);
         sampledButton.setRadioGroupId(321);
-        sampledButton.onClick = [this] { synthAudioSource.setUsingSampledSound(); };
+        sampledButton.onClick = [this]
+            {
+                synthAudioSource.setUsingSampledSound();
+                chooseSampleFile();
+            };
+
+        addAndMakeVisible(pianoButton);
+        pianoButton.setRadioGroupId(321);
+        pianoButton.onClick = [this] { synthAudioSource.setUsingPianoSound(); };
+
+        addChildComponent(loadProgressBar);
+        synthAudioSource.getSampleLoader().onProgress = [this](double progress)
+            {
+                loadProgress = progress;
+                loadProgressBar.setVisible(progress < 1.0);
+            };
+        synthAudioSource.getSampleLoader().onLoaded = [this](const juce::Result& result)
+            {
+                loadProgressBar.setVisible(false);
+
+                if (result.failed())
+                    juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "The sample couldn't be loaded",
+                                                           result.getErrorMessage());
+            };
 
         addAndMakeVisible(resetButton);
         resetButton.setToggleable(false);
-        resetButton.onClick = [this] {firstTime = true;  };
+        resetButton.onClick = [this] { synthAudioSource.resetPitchDrift(); };
 
         audioSourcePlayer.setSource(&synthAudioSource);
 
-        setSize (600, 160);
+        addAndMakeVisible(telemetryLabel);
+        telemetryLabel.setFont(textFont);
+        addAndMakeVisible(driftLabel);
+        driftLabel.setFont(textFont);
+        driftLabel.setJustificationType(juce::Justification::centredRight);
+        addAndMakeVisible(exportTelemetryButton);
+        exportTelemetryButton.onClick = [this] { chooseTelemetryFile(); };
+        telemetryExporter.onExported = [](const juce::Result& result)
+            {
+                if (result.failed())
+                    juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "The statistics couldn't be exported",
+                                                           result.getErrorMessage());
+            };
+
+        setSize (600, 205);
         startTimer (400);
         //shiri irish marhc 17 **IMPORTANT**
         addAndMakeVisible(limitInputListLabel);
@@ -500,6 +125,20 @@ public:
         limitInputListLabel.attachToComponent(&limitInputList, true);
         limitInputList.onChange = [this] { limitInputListChanged(); };
 
+        addAndMakeVisible(referenceList);
+        referenceList.addItem("Tune to lowest note", 1);
+        referenceList.addItem("Tune to chord root", 2);
+        referenceList.addItem("Tune to most consonant", 3);
+        referenceList.setSelectedId(1, juce::dontSendNotification);
+        referenceList.onChange = [this]
+            {
+                synthAudioSource.setReferenceStrategy((TuningReference::Strategy) (referenceList.getSelectedId() - 1));
+            };
+
+        addAndMakeVisible(loadScalaButton);
+        loadScalaButton.onClick = [this] { chooseScalaFiles(); };
+        scalaLibrary.onTuningsChanged = [this] { updateScalaTunings(); };
+
         addAndMakeVisible(midiInputListLabel);
         midiInputListLabel.setText("MIDI Input:", juce::dontSendNotification);
         midiInputListLabel.attachToComponent(&midiInputList, true);
@@ -530,80 +169,102 @@ public:
 
     ~MainContentComponent() override
     {
+        // the device manager outlives the synth, so the MIDI threads must stop
+        // calling into its queues first, whichever device was last chosen
+        for (auto& input : juce::MidiInput::getAvailableDevices())
+            deviceManager.removeMidiInputDeviceCallback(input.identifier, &synthAudioSource.getMidiInput());
+
         audioSourcePlayer.setSource(nullptr);
         shutdownAudio();
     }
 
     void limitInputListChanged() {
-        switch (limitInputList.getSelectedId())
-        {
-        case 1:
-            MinSec = 256.0/243.0;
-            MajSec = 9.0 / 8.0;
-            MinThi = 32.0/27.0;
-            MajThi = 81.0/64.0;
-            Fou = 4.0 / 3.0;
-            TT = 729.0/512.0;
-            Fif = 3.0 / 2.0;
-            MinSix = 128.0/81.0;
-            MajSix = 27.0/16.0;
-            MinSev = 16.0/9.0;
-            MajSev = 243.0/128.0;
-            Oct = 2.0;
-            break;
-        case 2:
-            MinSec = 16.0 / 15.0;
-            MajSec = 9.0/8.0;
-            MinThi = 6.0 / 5.0;
-            MajThi = 5.0 / 4.0;
-            Fou = 4.0 / 3.0;
-            TT = 25.0/18.0;
-            Fif = 3.0 / 2.0;
-            MinSix = 8.0 / 5.0;
-            MajSix = 5.0 / 3.0;
-            MinSev = 9.0/5.0;
-            MajSev = 15.0 / 8.0;
-            Oct = 2.0;
-            break;
-        case 3:
-            MinSec = 15.0 / 14.0;
-            MajSec = 8.0 / 7.0;
-            MinThi = 6.0 / 5.0;
-            MajThi = 5.0 / 4.0;
-            Fou = 4.0 / 3.0;
-            TT = 7.0 / 5.0;
-            Fif = 3.0 / 2.0;
-            MinSix = 8.0 / 5.0;
-            MajSix = 5.0 / 3.0;
-            MinSev = 7.0 / 4.0;
-            MajSev = 15.0 / 8.0;
-            Oct = 2.0;
-            break;
-        default: break;
+        auto selectedId = limitInputList.getSelectedId();
+
+        if (selectedId >= firstScalaItemId) {
+            if (auto table = scalaLibrary.createTable(selectedId - firstScalaItemId))
+                synthAudioSource.setTuningTable(std::move(table));
+        }
+        else {
+            synthAudioSource.setTuningLimit(selectedId);
         }
     }
 
-    void handleNoteOn(juce::MidiKeyboardState*, int midiChannel, int midiNoteNumber, float velocity) override {
-        notes.push_back(midiNoteNumber);
+    void chooseSampleFile()
+    {
+        sampleChooser = std::make_unique<juce::FileChooser>("Please select the wav or sfz you want to load...",
+            juce::File::getSpecialLocation(juce::File::userHomeDirectory),
+            "*.wav;*.sfz");
+
+        auto folderChooserFlags = juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles | juce::FileBrowserComponent::canSelectDirectories;
+        sampleChooser->launchAsync(folderChooserFlags, [this](const juce::FileChooser& chooser)
+            {
+                auto wavFile = chooser.getResult();
+
+                if (wavFile.existsAsFile())
+                    synthAudioSource.loadSampledSoundAsync(wavFile);
+            });
+    }
+
+    void chooseScalaFiles()
+    {
+        scalaChooser = std::make_unique<juce::FileChooser>("Please select the Scala scales you want to load...",
+            juce::File::getSpecialLocation(juce::File::userHomeDirectory),
+            "*.scl");
+
+        auto chooserFlags = juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles | juce::FileBrowserComponent::canSelectMultipleItems;
+        scalaChooser->launchAsync(chooserFlags, [this](const juce::FileChooser& chooser)
+            {
+                scalaLibrary.loadFiles(chooser.getResults());
+            });
+    }
+
+    /** Saves the block timing statistics as CSV or JSON, going by the extension. */
+    void chooseTelemetryFile()
+    {
+        telemetryChooser = std::make_unique<juce::FileChooser>("Export the audio block statistics as...",
+            juce::File::getSpecialLocation(juce::File::userHomeDirectory).getChildFile("block-stats.csv"),
+            "*.csv;*.json");
+
+        auto chooserFlags = juce::FileBrowserComponent::saveMode | juce::FileBrowserComponent::canSelectFiles | juce::FileBrowserComponent::warnAboutOverwriting;
+        telemetryChooser->launchAsync(chooserFlags, [this](const juce::FileChooser& chooser)
+            {
+                auto file = chooser.getResult();
+
+                if (file != juce::File())
+                    telemetryExporter.exportTo(file);
+            });
     }
 
-    void handleNoteOff(juce::MidiKeyboardState*, int midiChannel, int midiNoteNumber, float /*velocity*/) override {
-        notes.erase(std::remove(notes.begin(), notes.end(), midiNoteNumber), notes.end());
+    /** Adds the newly compiled Scala tunings to the limit menu. */
+    void updateScalaTunings()
+    {
+        for (int i = limitInputList.getNumItems() - numLimitItems; i < scalaLibrary.getNumTunings(); ++i)
+            limitInputList.addItem(scalaLibrary.getTuningName(i), firstScalaItemId + i);
+
+        auto errors = scalaLibrary.takeErrors();
+
+        if (! errors.isEmpty())
+            juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "Some scales couldn't be loaded",
+                                                   errors.joinIntoString("\n"));
     }
 
     void setMidiInput(int index)
     {
         auto list = juce::MidiInput::getAvailableDevices();
+        auto newInput = list[index];
 
-        deviceManager.removeMidiInputDeviceCallback(list[lastInputIndex].identifier,
-            synthAudioSource.getMidiCollector()); // [12]
+        // the device needs its own queue before its first message arrives
+        if (!synthAudioSource.getMidiInput().addInput(newInput.identifier))
+            return;
 
-        auto newInput = list[index];
+        deviceManager.removeMidiInputDeviceCallback(list[lastInputIndex].identifier,
+            &synthAudioSource.getMidiInput()); // [12]
 
         if (!deviceManager.isMidiInputDeviceEnabled(newInput.identifier))
             deviceManager.setMidiInputDeviceEnabled(newInput.identifier, true);
 
-        deviceManager.addMidiInputDeviceCallback(newInput.identifier, synthAudioSource.getMidiCollector()); // [13]
+        deviceManager.addMidiInputDeviceCallback(newInput.identifier, &synthAudioSource.getMidiInput()); // [13]
         midiInputList.setSelectedId(index + 1, juce::dontSendNotification);
 
         lastInputIndex = index;
@@ -613,10 +274,17 @@ public:
     {
         midiInputList.setBounds(50, 10, getWidth() - 210, 20);
         limitInputList.setBounds(50, 30, getWidth() - 350, 20);
-        sineButton.setBounds(16, getHeight() - 50, 150, 24);
-        sampledButton.setBounds(16, getHeight() - 30, 150, 24);
-        resetButton.setBounds(180, getHeight() - 45, 150, 36);
-        keyboardComponent.setBounds(10, 50, getWidth() - 20, getHeight() - 100);
+        loadScalaButton.setBounds(getWidth() - 290, 30, 120, 20);
+        referenceList.setBounds(getWidth() - 160, 30, 150, 20);
+        sineButton.setBounds(16, getHeight() - 70, 150, 24);
+        sampledButton.setBounds(16, getHeight() - 50, 150, 24);
+        pianoButton.setBounds(16, getHeight() - 30, 150, 24);
+        resetButton.setBounds(180, getHeight() - 55, 150, 36);
+        loadProgressBar.setBounds(340, getHeight() - 50, getWidth() - 350, 24);
+        keyboardComponent.setBounds(10, 50, getWidth() - 20, getHeight() - 150);
+        telemetryLabel.setBounds(10, getHeight() - 97, getWidth() - 290, 20);
+        driftLabel.setBounds(getWidth() - 280, getHeight() - 97, 120, 20);
+        exportTelemetryButton.setBounds(getWidth() - 150, getHeight() - 97, 140, 20);
     }
 
     void prepareToPlay (int samplesPerBlockExpected, double sampleRate) override
@@ -637,8 +305,14 @@ public:
 private:
     void timerCallback() override
     {
-        keyboardComponent.grabKeyboardFocus();
-        stopTimer();
+        if (! grabbedKeyboardFocus)
+        {
+            keyboardComponent.grabKeyboardFocus();
+            grabbedKeyboardFocus = true;
+        }
+
+        telemetryLabel.setText(synthAudioSource.getTelemetry().getSnapshot().getDescription(), juce::dontSendNotification);
+        driftLabel.setText(SynthAudioSource::describePitchDrift(synthAudioSource.getPitchDriftCents()), juce::dontSendNotification);
     }
 
     //==========================================================================
@@ -648,13 +322,28 @@ private:
     juce::MidiKeyboardComponent keyboardComponent;
     ToggleButton sineButton{ "Use sine wave" };
     ToggleButton sampledButton{ "Use sampled sound" };
+    ToggleButton pianoButton{ "Use additive piano" };
     TextButton resetButton{ "Reset Pitch Drift" };
+    TextButton loadScalaButton{ "Load Scala..." };
+    TextButton exportTelemetryButton{ "Export stats..." };
+    double loadProgress = 0.0;
+    juce::ProgressBar loadProgressBar{ loadProgress };
     juce::ComboBox limitInputList;
+    juce::ComboBox referenceList;
     juce::ComboBox midiInputList;
     juce::Label limitInputListLabel { {}, "Choose Limit:"};
     juce::Label midiInputListLabel;
+    juce::Label telemetryLabel;
+    juce::Label driftLabel;
     juce::Font textFont { 12.0f };
     int lastInputIndex = 0;
+    bool grabbedKeyboardFocus = false;
+    ScalaTuningLibrary scalaLibrary;
+    std::unique_ptr<FileChooser> sampleChooser, scalaChooser;
+    BlockTelemetryExporter telemetryExporter{ synthAudioSource.getTelemetry() };
+    std::unique_ptr<FileChooser> telemetryChooser;
+
+    static constexpr int numLimitItems = 3, firstScalaItemId = 100;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MainContentComponent)
 };
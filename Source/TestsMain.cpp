@@ -0,0 +1,285 @@
+/*
+  ==============================================================================
+
+    This file contains the startup code for the regression tests.
+
+    Three checks are run, and the exit code is non-zero if any fails:
+
+        tuning      OfflineRenderer::checkTuning(): just intervals played on
+                    the sine and on a multi-zone sampled instrument in every
+                    limit, measured against the just ratios themselves
+        renders     every MIDI file in Tests/Midi, rendered in every limit on
+                    both the sine and that sampled instrument, compared with
+                    the reference of the same name in Tests/References
+        block time  sixteen held notes on each sound, rendered through
+                    SynthAudioSource a block at a time; the 99th percentile
+                    block must take no longer than --max-block-us
+
+    References only show that nothing has changed, so the tuning check is
+    what shows the pitches were right to begin with. Both are needed.
+
+    The Tests folder is found by looking upwards from the executable, then
+    from the current directory, unless --fixtures names it. --record writes
+    the renders into Tests/References instead of comparing them: only do
+    that with a build whose output has been listened to and whose tuning
+    check passes.
+
+    Usage:
+        Tests [--fixtures Tests] [--record] [--cents 1] [--tolerance -90] [--max-block-us 1500]
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "OfflineRenderer.h"
+
+// a different rate from the test instrument's, so its samples are resampled
+static constexpr double renderSampleRate = 44100.0;
+
+//==============================================================================
+static void printUsage()
+{
+    std::cout << "Usage: Tests [--fixtures Tests] [--record] [--cents 1] [--tolerance -90] [--max-block-us 1500]" << std::endl;
+}
+
+/** The first Tests folder with a Midi folder in it, above the executable or
+    the current directory.
+*/
+static juce::File findFixtures()
+{
+    for (auto start : { juce::File::getSpecialLocation (juce::File::currentExecutableFile).getParentDirectory(),
+                        juce::File::getCurrentWorkingDirectory() })
+    {
+        for (auto directory = start;; directory = directory.getParentDirectory())
+        {
+            if (directory.getChildFile ("Tests").getChildFile ("Midi").isDirectory())
+                return directory.getChildFile ("Tests");
+
+            if (directory.isRoot())
+                break;
+        }
+    }
+
+    return {};
+}
+
+//==============================================================================
+/** Renders each MIDI file in every limit, on the sine and on the sampled
+    instrument, and compares each render with its reference, or records it
+    as the reference. Returns the number that failed.
+*/
+static int checkRenders (const juce::File& fixtures, const juce::File& instrument, const juce::File& outputDirectory,
+                         bool recording, double toleranceDb)
+{
+    auto midiFiles = fixtures.getChildFile ("Midi").findChildFiles (juce::File::findFiles, false, "*.mid");
+    auto references = fixtures.getChildFile ("References");
+    midiFiles.sort();
+
+    if (midiFiles.isEmpty())
+    {
+        std::cerr << "No MIDI files in " << fixtures.getChildFile ("Midi").getFullPathName() << std::endl;
+        return 1;
+    }
+
+    if (recording && ! references.createDirectory())
+    {
+        std::cerr << "Couldn't create " << references.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    int numFailed = 0;
+
+    for (auto& midiFile : midiFiles)
+    {
+        for (int limitId = 1; limitId <= 3; ++limitId)
+        {
+            for (auto sampled : { false, true })
+            {
+                OfflineRenderSettings settings;
+                settings.sampleRate = renderSampleRate;
+                settings.bitsPerSample = 16;
+                settings.tailSeconds = 1.0;
+                settings.tuningLimit = limitId;
+                settings.sampleFile = sampled ? instrument : juce::File();
+
+                auto name = midiFile.getFileNameWithoutExtension() + "-" + juce::String (limitId == 1 ? 3 : limitId == 2 ? 5 : 7)
+                              + "-limit-" + (sampled ? "sampler" : "sine") + ".wav";
+                auto rendered = outputDirectory.getChildFile (name);
+                auto reference = references.getChildFile (name);
+                auto result = OfflineRenderer (settings).render (midiFile, rendered);
+
+                if (result.wasOk() && recording)
+                {
+                    if (! rendered.copyFileTo (reference))
+                        result = juce::Result::fail ("Couldn't write " + reference.getFullPathName());
+                }
+                else if (result.wasOk() && ! reference.existsAsFile())
+                {
+                    result = juce::Result::fail ("No reference render " + reference.getFullPathName()
+                                                   + "; record the references with --record from a known-good build");
+                }
+                else if (result.wasOk())
+                {
+                    result = OfflineRenderer::compareWithReference (rendered, reference, toleranceDb);
+                }
+
+                if (result.failed())
+                {
+                    std::cerr << result.getErrorMessage() << std::endl;
+                    ++numFailed;
+                }
+                else
+                {
+                    std::cout << (recording ? "Recorded " : "Matched ") << name << std::endl;
+                }
+            }
+        }
+    }
+
+    return numFailed;
+}
+
+//==============================================================================
+enum class TimedSound
+{
+    sine,
+    sampler,
+    piano
+};
+
+/** Holds sixteen notes on one sound and renders a second of them, then
+    fails if the 99th percentile block took longer than maxMicroseconds.
+*/
+static juce::Result checkBlockTime (TimedSound sound, const juce::File& instrument, double maxMicroseconds)
+{
+    static constexpr int blockSize = 256;
+    static constexpr double sampleRate = 48000.0;
+    static constexpr int numNotes = 16;
+
+    juce::MidiKeyboardState keyboardState;
+    SynthAudioSource source (keyboardState);
+    auto name = juce::String (sound == TimedSound::sine ? "sine" : sound == TimedSound::sampler ? "sampler" : "piano");
+
+    if (sound == TimedSound::sampler && ! source.loadSampledSound (instrument))
+        return juce::Result::fail ("Couldn't load the test instrument " + instrument.getFullPathName());
+
+    if (sound == TimedSound::piano)
+        source.setUsingPianoSound();
+
+    source.prepareToPlay (blockSize, sampleRate);
+
+    juce::AudioBuffer<float> buffer (2, blockSize);
+    juce::MidiBuffer midi;
+
+    for (int i = 0; i < numNotes; ++i)
+        midi.addEvent (juce::MidiMessage::noteOn (1, 48 + 2 * i, 0.8f), 0);
+
+    // the first block starts every note, which isn't what's being timed
+    buffer.clear();
+    source.renderNextBlock (buffer, midi, 0, blockSize);
+    midi.clear();
+    source.getTelemetry().reset();
+
+    for (int block = 0; block < (int) sampleRate / blockSize; ++block)
+    {
+        buffer.clear();
+        source.renderNextBlock (buffer, midi, 0, blockSize);
+    }
+
+    auto snapshot = source.getTelemetry().getSnapshot();
+    auto p99 = snapshot.stageMicroseconds[(size_t) BlockTelemetry::Stage::block].p99;
+    auto description = name + ": 99th percentile block " + juce::String (p99, 1) + " us of "
+                         + juce::String (blockSize * 1.0e6 / sampleRate, 1) + " us, "
+                         + juce::String (snapshot.lastNumVoices) + " voices";
+
+    if (p99 > maxMicroseconds)
+        return juce::Result::fail (description + ", over the " + juce::String (maxMicroseconds, 1) + " us limit");
+
+    std::cout << description << std::endl;
+    return juce::Result::ok();
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    juce::StringArray args;
+
+    for (int i = 1; i < argc; ++i)
+        args.add (juce::CharPointer_UTF8 (argv[i]));
+
+    auto fixtures = findFixtures();
+    auto recording = false;
+    auto toleranceCents = 1.0;
+    auto toleranceDb = -90.0;
+    auto maxBlockMicroseconds = 1500.0;
+
+    for (int i = 0; i < args.size(); ++i)
+    {
+        auto arg = args[i];
+        auto hasValue = i + 1 < args.size();
+
+        if      (arg == "--fixtures" && hasValue)      fixtures = juce::File::getCurrentWorkingDirectory().getChildFile (args[++i]);
+        else if (arg == "--record")                    recording = true;
+        else if (arg == "--cents" && hasValue)         toleranceCents = args[++i].getDoubleValue();
+        else if (arg == "--tolerance" && hasValue)     toleranceDb = args[++i].getDoubleValue();
+        else if (arg == "--max-block-us" && hasValue)  maxBlockMicroseconds = args[++i].getDoubleValue();
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (! fixtures.isDirectory())
+    {
+        std::cerr << "Couldn't find the Tests folder; pass it as --fixtures" << std::endl;
+        return 1;
+    }
+
+    int numFailed = 0;
+    auto tuning = OfflineRenderer::checkTuning (renderSampleRate, toleranceCents);
+
+    if (tuning.failed())
+    {
+        std::cerr << tuning.getErrorMessage() << std::endl;
+        ++numFailed;
+    }
+    else
+    {
+        std::cout << "Every note is within " << toleranceCents << " cents of its just ratio" << std::endl;
+    }
+
+    auto workDirectory = juce::File::getSpecialLocation (juce::File::tempDirectory)
+                            .getNonexistentChildFile ("AdaptiveTuningTests", {}, false);
+    auto instrument = workDirectory.getChildFile ("Instrument").getChildFile ("zones.sfz");
+    auto outputDirectory = workDirectory.getChildFile ("Renders");
+    auto result = OfflineRenderer::createTestInstrument (instrument);
+
+    if (result.wasOk() && ! outputDirectory.createDirectory())
+        result = juce::Result::fail ("Couldn't create " + outputDirectory.getFullPathName());
+
+    if (result.failed())
+    {
+        std::cerr << result.getErrorMessage() << std::endl;
+        workDirectory.deleteRecursively();
+        return 1;
+    }
+
+    numFailed += checkRenders (fixtures, instrument, outputDirectory, recording, toleranceDb);
+
+    for (auto sound : { TimedSound::sine, TimedSound::sampler, TimedSound::piano })
+    {
+        auto timing = checkBlockTime (sound, instrument, maxBlockMicroseconds);
+
+        if (timing.failed())
+        {
+            std::cerr << timing.getErrorMessage() << std::endl;
+            ++numFailed;
+        }
+    }
+
+    workDirectory.deleteRecursively();
+
+    std::cout << (numFailed == 0 ? "All tests passed" : juce::String (numFailed) + " failed") << std::endl;
+    return numFailed == 0 ? 0 : 1;
+}
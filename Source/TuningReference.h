@@ -0,0 +1,162 @@
+/*
+  ==============================================================================
+
+    TuningReference.h
+
+    Decides which held note the adaptive tuning follows when there's
+    harmony. The held notes are reduced to a 12-bit set of pitch classes,
+    and tables indexed by that set, built once before any audio runs, list
+    the pitch classes each strategy would pick, so a ten-note chord costs
+    the audio thread no more than a dyad.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "HeldNoteSet.h"
+#include "TuningTable.h"
+
+//==============================================================================
+namespace TuningReference
+{
+    enum class Strategy
+    {
+        lowestNote,     // the bass, whatever the chord
+        chordRoot,      // the root of the chord, so inversions tune like root position
+        mostConsonant   // the note forming the simplest ratios with all the others
+    };
+
+    inline juce::String getName (Strategy strategy)
+    {
+        switch (strategy)
+        {
+            case Strategy::chordRoot:       return "root";
+            case Strategy::mostConsonant:   return "consonant";
+            case Strategy::lowestNote:
+            default:                        return "lowest";
+        }
+    }
+
+    /** Parses a name returned by getName(). Returns false if it isn't one. */
+    inline bool parseName (const juce::String& name, Strategy& result)
+    {
+        for (auto strategy : { Strategy::lowestNote, Strategy::chordRoot, Strategy::mostConsonant })
+        {
+            if (name == getName (strategy))
+            {
+                result = strategy;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    //==============================================================================
+    /** For every set of pitch classes, the members that could serve as the
+        reference under each strategy. Ties are kept, so the caller can break
+        them with the bass.
+    */
+    class PitchClassTable
+    {
+    public:
+        /** The shared table. It's built the first time this is called, which
+            the engine does on construction, so never on the audio thread.
+        */
+        static const PitchClassTable& get()
+        {
+            static const PitchClassTable table;
+            return table;
+        }
+
+        /** The candidate pitch classes, as a 12-bit set, for a set of held
+            pitch classes. Not meant for Strategy::lowestNote, which needs no table.
+        */
+        juce::uint16 getCandidates (Strategy strategy, juce::uint16 pitchClassSet) const noexcept
+        {
+            jassert (pitchClassSet < numSets);
+            return (strategy == Strategy::chordRoot ? roots : consonant)[pitchClassSet];
+        }
+
+    private:
+        static constexpr int numSets = 1 << 12;
+
+        PitchClassTable()
+        {
+            for (int set = 0; set < numSets; ++set)
+            {
+                roots[(size_t) set] = findBest (set, [] (int root, int pitchClass)
+                {
+                    return (double) rootSupport[(size_t) ((pitchClass - root + 12) % 12)];
+                });
+
+                // the product of numerator times denominator over every interval, so
+                // fewer and simpler ratios win; negated, as findBest() looks for a maximum
+                consonant[(size_t) set] = findBest (set, [] (int root, int pitchClass)
+                {
+                    auto& ratio = JustIntonation::fiveLimit[(size_t) ((pitchClass - root + 12) % 12)];
+                    return -std::log2 ((double) (ratio.numerator * ratio.denominator));
+                });
+            }
+        }
+
+        /** Scores each member of the set as the reference by adding up
+            intervalScore (candidate, other) over every member, and returns the
+            best, along with any that tie.
+        */
+        template <typename IntervalScoreFunction>
+        static juce::uint16 findBest (int set, IntervalScoreFunction&& intervalScore)
+        {
+            juce::uint16 best = 0;
+            double bestScore = 0.0;
+
+            for (int candidate = 0; candidate < 12; ++candidate)
+            {
+                if ((set & (1 << candidate)) == 0)
+                    continue;
+
+                double score = 0.0;
+
+                for (int other = 0; other < 12; ++other)
+                    if ((set & (1 << other)) != 0)
+                        score += intervalScore (candidate, other);
+
+                if (best == 0 || score > bestScore + tolerance)
+                {
+                    best = (juce::uint16) (1 << candidate);
+                    bestScore = score;
+                }
+                else if (score > bestScore - tolerance)
+                {
+                    best |= (juce::uint16) (1 << candidate);
+                }
+            }
+
+            return best;
+        }
+
+        /** How strongly an interval above a note suggests that note is the root,
+            from Parncutt's root-support weights: the unison, fifth, major third,
+            minor seventh and major second, in that order.
+        */
+        static constexpr std::array<int, 12> rootSupport { 10, 0, 1, 0, 3, 0, 0, 5, 0, 0, 2, 0 };
+
+        static constexpr double tolerance = 1.0e-9;
+
+        std::array<juce::uint16, numSets> roots, consonant;
+    };
+
+    //==============================================================================
+    /** Returns the held note to use as the tuning reference, or -1 if nothing
+        is held. When several pitch classes qualify, or a pitch class is held
+        in more than one octave, the lowest note among them is used.
+    */
+    inline int findReferenceNote (const HeldNoteSet& notes, Strategy strategy, const PitchClassTable& table) noexcept
+    {
+        if (strategy == Strategy::lowestNote)
+            return notes.getLowestNote();
+
+        return notes.getLowestNoteInPitchClasses (table.getCandidates (strategy, notes.getPitchClassSet()));
+    }
+}
@@ -0,0 +1,303 @@
+/*
+  ==============================================================================
+
+    TuningTable.h
+
+    The just intonation systems as constexpr data, the flat ratio tables
+    generated from them at compile time, and the publisher that hands the
+    current table from the message thread to the audio thread without locks.
+
+    Tables built from 7-limit ratios also carry each interval as a vector of
+    prime exponents, so the adaptive tuning can move its reference by exact
+    integer additions instead of accumulating floating point products.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+namespace JustIntonation
+{
+    struct Ratio
+    {
+        constexpr double toDouble() const noexcept    { return (double) numerator / (double) denominator; }
+
+        juce::int64 numerator, denominator;
+    };
+
+    /** The ratio of each of the 12 intervals from the unison up to the major seventh. */
+    using Scale = std::array<Ratio, 12>;
+
+    constexpr Ratio octave { 2, 1 };
+
+    //==============================================================================
+    /** A ratio as the exponents of 2, 3, 5 and 7, e.g. 5/4 is { -2, 0, 1, 0 }.
+        Multiplying ratios is adding vectors, so no rounding ever builds up.
+    */
+    struct PrimeExponents
+    {
+        static constexpr int numPrimes = 4;
+        static constexpr std::array<int, numPrimes> primes { 2, 3, 5, 7 };
+
+        constexpr PrimeExponents& operator+= (const PrimeExponents& other) noexcept
+        {
+            for (size_t i = 0; i < (size_t) numPrimes; ++i)
+                exponents[i] += other.exponents[i];
+
+            return *this;
+        }
+
+        /** Factorises a ratio. Returns false if either side has a prime factor above 7. */
+        static constexpr bool fromRatio (Ratio ratio, PrimeExponents& result) noexcept
+        {
+            result = {};
+
+            for (size_t i = 0; i < (size_t) numPrimes; ++i)
+            {
+                for (; ratio.numerator % primes[i] == 0; ratio.numerator /= primes[i])      ++result.exponents[i];
+                for (; ratio.denominator % primes[i] == 0; ratio.denominator /= primes[i])  --result.exponents[i];
+            }
+
+            return ratio.numerator == 1 && ratio.denominator == 1;
+        }
+
+        /** The ratio as a double, within a few ulps of exact. The powers of
+            each prime come from a table; only exponents too large for it,
+            whose separate powers could overflow, go through exp2().
+        */
+        double toDouble() const noexcept
+        {
+            double ratio = 1.0;
+
+            for (size_t i = 0; i < (size_t) numPrimes; ++i)
+            {
+                if (exponents[i] < -maxCachedPower || exponents[i] > maxCachedPower)
+                    return std::exp2 (toCents() / 1200.0);
+
+                ratio *= getPowers()[i][(size_t) (exponents[i] + maxCachedPower)];
+            }
+
+            return ratio;
+        }
+
+        /** The size of the interval in cents. */
+        double toCents() const noexcept
+        {
+            constexpr std::array<double, numPrimes> centsPerPrime { 1200.0, 1901.955000865387, 2786.313713864835, 3368.825906469125 };
+            double cents = 0.0;
+
+            for (size_t i = 0; i < (size_t) numPrimes; ++i)
+                cents += exponents[i] * centsPerPrime[i];
+
+            return cents;
+        }
+
+        std::array<int, numPrimes> exponents {};
+
+    private:
+        static constexpr int maxCachedPower = 64;
+        using PowerTable = std::array<std::array<double, 2 * maxCachedPower + 1>, numPrimes>;
+
+        static constexpr PowerTable createPowerTable() noexcept
+        {
+            PowerTable table {};
+
+            for (size_t i = 0; i < (size_t) numPrimes; ++i)
+            {
+                double power = 1.0;
+
+                for (int k = 0; k <= maxCachedPower; ++k, power *= primes[i])
+                {
+                    table[i][(size_t) (maxCachedPower + k)] = power;
+                    table[i][(size_t) (maxCachedPower - k)] = 1.0 / power;
+                }
+            }
+
+            return table;
+        }
+
+        static const PowerTable& getPowers() noexcept
+        {
+            static constexpr PowerTable powers = createPowerTable();
+            return powers;
+        }
+    };
+
+    constexpr Scale threeLimit {{ { 1, 1 }, { 256, 243 }, { 9, 8 }, { 32, 27 }, { 81, 64 }, { 4, 3 },
+                                  { 729, 512 }, { 3, 2 }, { 128, 81 }, { 27, 16 }, { 16, 9 }, { 243, 128 } }};
+
+    constexpr Scale fiveLimit  {{ { 1, 1 }, { 16, 15 }, { 9, 8 }, { 6, 5 }, { 5, 4 }, { 4, 3 },
+                                  { 25, 18 }, { 3, 2 }, { 8, 5 }, { 5, 3 }, { 9, 5 }, { 15, 8 } }};
+
+    constexpr Scale sevenLimit {{ { 1, 1 }, { 15, 14 }, { 8, 7 }, { 6, 5 }, { 5, 4 }, { 4, 3 },
+                                  { 7, 5 }, { 3, 2 }, { 8, 5 }, { 5, 3 }, { 7, 4 }, { 15, 8 } }};
+}
+
+//==============================================================================
+/** The ratio for every interval between two MIDI notes, from 127 semitones
+    down to 127 semitones up, so finding the pitch of a note relative to the
+    reference is one lookup. Once a table has been published it's never
+    modified.
+*/
+struct TuningTable
+{
+    static constexpr int maxInterval = 127;
+
+    double getRatioForInterval (int semitones) const noexcept
+    {
+        jassert (semitones >= -maxInterval && semitones <= maxInterval);
+        return intervalRatios[(size_t) (semitones + maxInterval)];
+    }
+
+    /** True if every interval is a 7-limit ratio, available from
+        getExponentsForInterval(). Tables compiled from Scala files aren't.
+    */
+    bool isExact() const noexcept       { return exact; }
+
+    const JustIntonation::PrimeExponents& getExponentsForInterval (int semitones) const noexcept
+    {
+        jassert (exact && semitones >= -maxInterval && semitones <= maxInterval);
+        return intervalExponents[(size_t) (semitones + maxInterval)];
+    }
+
+    /** Fills in every interval from a repeating scale: interval i uses degree
+        i mod numDegrees, multiplied by the period once for each whole period
+        it spans. degreeRatio (d) must return the ratio of degree d.
+    */
+    template <typename DegreeRatioFunction>
+    static constexpr TuningTable build (int numDegrees, double period, DegreeRatioFunction&& degreeRatio)
+    {
+        TuningTable table {};
+
+        for (int interval = -maxInterval; interval <= maxInterval; ++interval)
+        {
+            auto periods = interval >= 0 ? interval / numDegrees
+                                         : -((numDegrees - 1 - interval) / numDegrees);
+            auto ratio = degreeRatio (interval - periods * numDegrees);
+
+            for (int i = 0; i < periods; ++i)   ratio *= period;
+            for (int i = 0; i > periods; --i)   ratio /= period;
+
+            table.intervalRatios[(size_t) (interval + maxInterval)] = ratio;
+        }
+
+        return table;
+    }
+
+    static constexpr TuningTable fromScale (const JustIntonation::Scale& scale)
+    {
+        auto numDegrees = (int) scale.size();
+        auto table = build (numDegrees, JustIntonation::octave.toDouble(),
+                            [&scale] (int degree) { return scale[(size_t) degree].toDouble(); });
+
+        std::array<JustIntonation::PrimeExponents, 12> degrees {};
+        JustIntonation::PrimeExponents octave {};
+        table.exact = JustIntonation::PrimeExponents::fromRatio (JustIntonation::octave, octave);
+
+        for (size_t i = 0; i < degrees.size(); ++i)
+            table.exact = JustIntonation::PrimeExponents::fromRatio (scale[i], degrees[i]) && table.exact;
+
+        for (int interval = -maxInterval; interval <= maxInterval; ++interval)
+        {
+            auto periods = interval >= 0 ? interval / numDegrees
+                                         : -((numDegrees - 1 - interval) / numDegrees);
+            auto& exponents = table.intervalExponents[(size_t) (interval + maxInterval)];
+            exponents = degrees[(size_t) (interval - periods * numDegrees)];
+
+            for (size_t i = 0; i < (size_t) JustIntonation::PrimeExponents::numPrimes; ++i)
+                exponents.exponents[i] += periods * octave.exponents[i];
+        }
+
+        return table;
+    }
+
+    /** Returns the table for one of the limit menu entries: 1 is 3-limit
+        (Pythagorean), 2 is 5-limit and 3 is 7-limit. These are all built at
+        compile time.
+    */
+    static const TuningTable& getForLimit (int limitId)
+    {
+        static constexpr auto threeLimit = fromScale (JustIntonation::threeLimit);
+        static constexpr auto fiveLimit  = fromScale (JustIntonation::fiveLimit);
+        static constexpr auto sevenLimit = fromScale (JustIntonation::sevenLimit);
+
+        switch (limitId)
+        {
+            case 1:   return threeLimit;
+            case 2:   return fiveLimit;
+            default:  return sevenLimit;
+        }
+    }
+
+    /** The table an engine starts with before a limit has been chosen. */
+    static const TuningTable& getDefault()      { return getForLimit (3); }
+
+    std::array<double, 2 * maxInterval + 1> intervalRatios {};
+    std::array<JustIntonation::PrimeExponents, 2 * maxInterval + 1> intervalExponents {};
+    bool exact = false;
+};
+
+//==============================================================================
+/** Hands tuning tables from the message thread to the audio thread.
+
+    publish() swaps in a new table with an atomic exchange. The audio thread
+    calls acquire() once per block and keeps using that table for the whole
+    block; the table it's using is advertised so that the message thread
+    never deletes it from under it. acquire() never blocks or allocates.
+*/
+class TuningTablePublisher
+{
+public:
+    TuningTablePublisher() = default;
+
+    /** Message thread only. */
+    void publish (std::unique_ptr<TuningTable> newTable)
+    {
+        current.exchange (newTable.get());
+        ownedTables.add (newTable.release());
+
+        // anything that's neither current nor held by the audio thread can't
+        // be picked up again, so it's safe to delete
+        auto* live = current.load();
+        auto* used = inUse.load();
+
+        for (int i = ownedTables.size(); --i >= 0;)
+            if (ownedTables.getUnchecked (i) != live && ownedTables.getUnchecked (i) != used)
+                ownedTables.remove (i);
+    }
+
+    /** Swaps in a table that's never deleted, like getForLimit()'s. This
+        neither allocates nor frees anything, so it can be called from any
+        thread, the audio thread included. A published table it replaces is
+        deleted by the next call to the other publish().
+    */
+    void publish (const TuningTable& permanentTable) noexcept
+    {
+        current.exchange (&permanentTable);
+    }
+
+    /** Audio thread only. The table stays valid until the next call. */
+    const TuningTable& acquire() noexcept
+    {
+        auto* table = current.load();
+
+        for (;;)
+        {
+            inUse.store (table);
+            auto* latest = current.load();
+
+            if (latest == table)
+                return *table;
+
+            table = latest;
+        }
+    }
+
+private:
+    std::atomic<const TuningTable*> current { &TuningTable::getDefault() };
+    std::atomic<const TuningTable*> inUse { nullptr };
+    juce::OwnedArray<TuningTable> ownedTables;
+
+    JUCE_DECLARE_NON_COPYABLE (TuningTablePublisher)
+};
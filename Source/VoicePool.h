@@ -0,0 +1,190 @@
+/*
+  ==============================================================================
+
+    VoicePool.h
+
+    Keeps track of which of a synth's voices are free, so a note-on takes a
+    voice off a free list instead of asking every voice whether it's busy
+    and whether it can play the sound. Voices whose notes have ended go back
+    on the list once per block, and when none are free the voice to steal is
+    chosen from the playing ones without allocating. Released voices that
+    have gone quiet enough to be inaudible can be ended early, so a pedalled
+    chord's long tails stop costing anything once nobody can hear them.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+/** A voice that can tell the pool how good a candidate it is for stealing. */
+class StealableVoice  : public juce::SynthesiserVoice
+{
+public:
+    /** Roughly how loud the note is at the moment, from 0 to 1. */
+    virtual float getCurrentLevel() const noexcept = 0;
+
+    /** The number of samples rendered since the note was released, or -1
+        while it's still held.
+    */
+    virtual juce::int64 getSamplesSinceRelease() const noexcept = 0;
+
+    /** The largest sample magnitude the note has added to the output since
+        the last call, which starts the next measurement.
+    */
+    virtual float takePeakLevel() noexcept = 0;
+};
+
+//==============================================================================
+/** The free and playing voices of a synth. Everything except reset() belongs
+    to the audio thread, and nothing except reset() allocates.
+*/
+class VoicePool
+{
+public:
+    /** Rebuilds the pool for a new set of voices. Call this whenever the
+        synth's voices change, before any of them is rendered.
+    */
+    void reset (const juce::OwnedArray<juce::SynthesiserVoice>& voices)
+    {
+        auto numVoices = (size_t) voices.size();
+
+        entries.clear();
+        freeVoices.clear();
+        playingVoices.clear();
+
+        entries.reserve (numVoices);
+        freeVoices.reserve (numVoices);
+        playingVoices.reserve (numVoices);
+
+        for (auto* voice : voices)
+            entries.push_back ({ voice, dynamic_cast<StealableVoice*> (voice), 0 });
+
+        // pushed in reverse, so the first voice is the first one taken
+        for (auto i = (int) numVoices; --i >= 0;)
+            (voices[i]->isVoiceActive() ? playingVoices : freeVoices).push_back (i);
+    }
+
+    /** False if the synth's voices have changed since the last reset(). */
+    bool isFor (const juce::OwnedArray<juce::SynthesiserVoice>& voices) const noexcept
+    {
+        return entries.size() == (size_t) voices.size();
+    }
+
+    /** Takes a voice off the free list, or returns nullptr if they're all playing. */
+    juce::SynthesiserVoice* takeFreeVoice() noexcept
+    {
+        // a voice may have been stopped outright since the last block
+        if (freeVoices.empty())
+            collectFinishedVoices();
+
+        if (freeVoices.empty())
+            return nullptr;
+
+        auto index = freeVoices.back();
+        freeVoices.pop_back();
+        playingVoices.push_back (index);
+        entries[(size_t) index].quietSamples = 0;
+        return entries[(size_t) index].voice;
+    }
+
+    /** Picks the playing voice that will be missed least: the one released
+        longest ago, or if every note is still held, the quietest.
+    */
+    juce::SynthesiserVoice* findVoiceToSteal() noexcept
+    {
+        Entry* best = nullptr;
+        juce::int64 bestAge = -1;
+        float bestLevel = 0.0f;
+
+        for (auto index : playingVoices)
+        {
+            auto& entry = entries[(size_t) index];
+            auto released = entry.voice->isPlayingButReleased();
+            auto age = released ? (entry.stealable != nullptr ? juce::jmax ((juce::int64) 0, entry.stealable->getSamplesSinceRelease()) : 0) : -1;
+            auto level = entry.stealable != nullptr ? entry.stealable->getCurrentLevel() : 1.0f;
+
+            if (best == nullptr || age > bestAge || (age == bestAge && level < bestLevel))
+            {
+                best = &entry;
+                bestAge = age;
+                bestLevel = level;
+            }
+        }
+
+        if (best == nullptr)
+            return nullptr;
+
+        // the stolen voice starts a new note, which hasn't been quiet for any time yet
+        best->quietSamples = 0;
+        return best->voice;
+    }
+
+    /** Ends the notes of released voices, or ones only the sustain pedal is
+        holding, that have added nothing louder than threshold to the output
+        for at least holdSamples, counting the numSamples just rendered, and
+        returns them to the free list. A note whose key is still down is
+        never ended, however quiet it is, since it may be a soft note under
+        a loud chord or a sample that starts with silence. Call this once
+        per block, after every voice has rendered. Returns how many were
+        ended.
+    */
+    int cullInaudibleVoices (float threshold, int numSamples, int holdSamples) noexcept
+    {
+        int numCulled = 0;
+
+        for (auto index : playingVoices)
+        {
+            auto& entry = entries[(size_t) index];
+
+            if (entry.stealable == nullptr || ! entry.voice->isVoiceActive())
+                continue;
+
+            // the key's time doesn't count, so a release starts from no quiet time at all
+            if (entry.stealable->takePeakLevel() >= threshold || entry.voice->isKeyDown())
+            {
+                entry.quietSamples = 0;
+            }
+            else if ((entry.quietSamples += numSamples) >= holdSamples)
+            {
+                entry.voice->stopNote (0.0f, false);
+                ++numCulled;
+            }
+        }
+
+        if (numCulled > 0)
+            collectFinishedVoices();
+
+        return numCulled;
+    }
+
+    /** Returns the voices whose notes have ended to the free list. */
+    void collectFinishedVoices() noexcept
+    {
+        for (auto i = playingVoices.size(); i-- > 0;)
+        {
+            auto index = playingVoices[i];
+
+            if (! entries[(size_t) index].voice->isVoiceActive())
+            {
+                playingVoices[i] = playingVoices.back();
+                playingVoices.pop_back();
+                freeVoices.push_back (index);
+            }
+        }
+    }
+
+    int getNumPlayingVoices() const noexcept                         { return (int) playingVoices.size(); }
+    juce::SynthesiserVoice* getPlayingVoice (int i) const noexcept  { return entries[(size_t) playingVoices[(size_t) i]].voice; }
+
+private:
+    struct Entry
+    {
+        juce::SynthesiserVoice* voice;
+        StealableVoice* stealable;      // nullptr if the voice can't say how loud it is
+        juce::int64 quietSamples;       // how long the voice has been below the culling threshold
+    };
+
+    std::vector<Entry> entries;
+    std::vector<int> freeVoices, playingVoices;
+};